@@ -0,0 +1,88 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include "library.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc != 5)
+	{
+		fprintf(stderr, "USAGE: build_bitmap <colstore_name> <attribute_id>[,<attribute_id>...] "
+			"<prefix_len> <page_size>\n");
+		exit(1);
+	}
+
+	//start timer
+	long start = wall_clock_msec();
+
+	char *storeName = argv[1];
+	char *attrNames = argv[2];
+	int prefixLen = atoi(argv[3]);
+	int pageSize = atoi(argv[4]);
+
+	std::vector<int> attrs;
+	std::string attrList(attrNames);
+	for (char *name = strtok(&attrList[0], ","); name != NULL; name = strtok(NULL, ","))
+	{
+		attrs.push_back(atoi(name));
+		if (attrs.back() < 0 || attrs.back() >= ATTR_PER_RECORD)
+		{
+			fprintf(stderr, "Could not find column for attribute %s\n", name);
+			exit(1);
+		}
+	}
+	if (prefixLen < 1 || prefixLen > BITMAP_MAX_PREFIX)
+	{
+		fprintf(stderr, "<prefix_len> must be between 1 and %d\n", BITMAP_MAX_PREFIX);
+		exit(1);
+	}
+
+	FILE *f = fopen(storeName, "rb");
+	if (f == NULL)
+	{
+		fprintf(stderr, "Could not open column store %s for reading.\n", storeName);
+		exit(1);
+	}
+	Colstore colstore;
+	if (!open_colstore(&colstore, pageSize, f))
+	{
+		exit(1);
+	}
+
+	//one file per attribute, so each can be rebuilt on its own
+	for (int a = 0; a < attrs.size(); a++)
+	{
+		BitmapIndex index;
+		if (!build_bitmap_index(&index, &colstore, attrs[a], prefixLen))
+		{
+			fprintf(stderr, "Could not build bitmap index on attribute %d\n", attrs[a]);
+			exit(1);
+		}
+		std::string indexName = bitmap_index_path(storeName, attrs[a]);
+		FILE *out = fopen(indexName.c_str(), "wb");
+		if (out == NULL)
+		{
+			fprintf(stderr, "Could not create bitmap index %s\n", indexName.c_str());
+			exit(1);
+		}
+		write_bitmap_index(&index, out);
+
+		long containers = 0;
+		for (int k = 0; k < index.bitmaps->size(); k++)
+		{
+			containers += index.bitmaps->at(k).size();
+		}
+		fprintf(stdout, "bitmap index %s: %lu prefixes, %ld containers, %ld bytes\n", indexName.c_str(),
+			(unsigned long) index.prefixes->size(), containers, ftell(out));
+		fclose(out);
+		free_bitmap_index(&index);
+	}
+
+	close_colstore(&colstore);
+
+	fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include "library.h"
+
+using namespace std;
+
+void check_argv(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) {
+    check_argv(argc, argv);
+
+    char *heapfile_name = argv[1];
+    int attr_id = atoi(argv[2]);
+    int page_size = atoi(argv[3]);
+    bool hash = (argc == 5);
+
+    //start timer
+    long start = wall_clock_msec();
+
+    // Initialize heap file.
+    Heapfile *heapfile = new Heapfile;
+    FILE *f = fopen(heapfile_name, "rb+");
+    if (f == NULL) {
+        fputs("heap file doesn't exist.\n", stderr);
+        exit(2);
+    }
+    open_heapfile(heapfile, page_size, f);
+
+    string index_name = hash ? hash_index_path(heapfile_name, attr_id) : index_path(heapfile_name, attr_id);
+    FILE *index_file = fopen(index_name.c_str(), "wb+");
+    if (index_file == NULL) {
+        fprintf(stderr, "index file %s can't be created.\n", index_name.c_str());
+        exit(2);
+    }
+    if (hash) {
+        HashIndex index;
+        build_hash_index(&index, index_file, heapfile, attr_id);
+        fprintf(stdout, "index %s: %lu entries, %u pages, global depth %u\n", index_name.c_str(),
+                (unsigned long) index.num_entries, index.num_pages, index.global_depth);
+        close_hash_index(&index);
+    } else {
+        BTree tree;
+        build_index(&tree, index_file, heapfile, attr_id);
+        fprintf(stdout, "index %s: %lu entries, %u nodes, height %u\n", index_name.c_str(),
+                (unsigned long) tree.num_entries, tree.num_nodes, tree.height);
+        close_index(&tree);
+    }
+
+    close_heapfile(heapfile);
+
+    print_buffer_pool_stats(stdout);
+
+    fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
+}
+
+void check_argv(int argc, char *argv[]) {
+    if((argc != 4 && argc != 5) || (argc == 5 && strcmp(argv[4], "hash") != 0)) {
+        fputs("usage: build_index <heapfile> <attribute_id> <page_size> [hash]\n",stderr);
+        exit(2);
+    }
+
+    if ((atoi(argv[2]) <= 0 or atoi(argv[2]) >= ATTR_PER_RECORD) && !(strcmp(argv[2], "0") == 0)) {
+        fprintf(stderr, "usage: <attribute_id> must be integer and greater or equal to zero and smaller than number of attribute which is %d \n", ATTR_PER_RECORD);
+        exit(2);
+    }
+
+    if (atoi(argv[3]) <= 0) {
+        fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
+}
@@ -1,156 +1,341 @@
 #include <iterator>
-#include <sys/stat.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <stdio.h>
 #include <cstring>
+#include <algorithm>
+#include <queue>
 #include "library.h"
 
 using namespace std;
 
+//rows sorted in memory at once; longer inputs are spilled in runs of this many
+#define SORT_RUN_ROWS 65536
+//rows read ahead from each run while merging
+#define MERGE_BUFFER_ROWS 256
+//rows handed to the writer at once, so it still transposes tiles
+#define APPEND_BATCH_ROWS 4096
+
+typedef struct {
+    ColstoreWriter *writer;
+    int numGroups; //columns are split into this many groups, one thread each
+    int sortAttr;  //attribute of a sorted projection, or -1
+    std::vector<char> rows; //rows of the current run, kept when sorting
+    std::vector<FILE *> runs; //sorted runs already spilled to temporary files
+} ColumnState;
+
+//a spilled run being merged, with the rows read ahead from it
+typedef struct {
+    FILE *file;
+    std::vector<char> rows;
+    int count;
+    int next;
+} SortRun;
+
+//orders row numbers by the sort attribute of their rows
+struct RowOrder {
+    const char *rows;
+    int attr;
+    bool operator()(int a, int b) const {
+        return memcmp(rows + (size_t) a * SLOT_SIZE + attr * ATTRIBUTE_SIZE,
+            rows + (size_t) b * SLOT_SIZE + attr * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE) < 0;
+    }
+};
+
+//puts the run with the smallest next row on top of a priority queue,
+//the earlier run first on ties so equal values keep their file order
+struct RunOrder {
+    const std::vector<SortRun> *runs;
+    int attr;
+    bool operator()(int a, int b) const {
+        const SortRun &ra = runs->at(a);
+        const SortRun &rb = runs->at(b);
+        int cmp = memcmp(&ra.rows[(size_t) ra.next * SLOT_SIZE + attr * ATTRIBUTE_SIZE],
+            &rb.rows[(size_t) rb.next * SLOT_SIZE + attr * ATTRIBUTE_SIZE], ATTRIBUTE_SIZE);
+        return cmp > 0 || (cmp == 0 && a > b);
+    }
+};
+
+void store_rows(char *rows, int num_rows, void *arg);
+void sort_run(ColumnState *state, std::vector<int> *order);
+void spill_run(ColumnState *state);
+bool fill_run(SortRun *run);
+void store_sorted(ColumnState *state);
+
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
+    //a trailing "bloom <attribute_id>[,<attribute_id>...]" adds Bloom filters on those columns
+    std::vector<int> bloomAttrs;
+    if (argc > 2 && strcmp(argv[argc - 2], "bloom") == 0)
+    {
+        for (char *name = strtok(argv[argc - 1], ","); name != NULL; name = strtok(NULL, ","))
+        {
+            bloomAttrs.push_back(atoi(name));
+            if (bloomAttrs.back() < 0 || bloomAttrs.back() >= ATTR_PER_RECORD)
+            {
+                fprintf(stderr, "<attribute_id> must be between 0 and %d\n", ATTR_PER_RECORD - 1);
+                exit(1);
+            }
+        }
+        argc -= 2;
+    }
+
+    if (argc < 4 || argc > 7)
     {
         fprintf(stderr, "USAGE: csv2colstore <csv_file> <colstore_name>"
-            "<pagesize>\n");
+            "<pagesize> [<num_threads> [<column_groups> [<sort_attribute>]]] "
+            "[bloom <attribute_id>[,<attribute_id>...]]\n");
         exit(1);
     }
-    //USAGE: csv2colstore <csv_file> <colstore_name> <pagesize>
+    //USAGE: csv2colstore <csv_file> <colstore_name> <pagesize> [<num_threads> [<column_groups> [<sort_attribute>]]] [bloom <attribute_id>[,<attribute_id>...]]
 
     //start timer
-    clock_t start = clock();
+    long start = wall_clock_msec();
 
-    if (!ifstream(argv[1]))
+    int numThreads = (argc > 4) ? atoi(argv[4]) : 1;
+    if (numThreads <= 0)
     {
-        fprintf(stderr, "Cannot open CSV file: %s", argv[1]);
+        fprintf(stderr, "<num_threads> must be greater than zero\n");
         exit(1);
     }
-    ifstream csvfile(argv[1]);
 
-    if (mkdir(argv[2], S_IRWXU | S_IRWXG | S_IROTH) == -1)
+    int numGroups = (argc > 5) ? atoi(argv[5]) : 1;
+    if (numGroups <= 0 || numGroups > ATTR_PER_RECORD)
     {
-        if (errno != EEXIST) { //if directory exists, swallow exception
-            fprintf(stderr, "Could not create storage directory: %s\n", argv[2]);
-            exit(1);
-        }
-
+        fprintf(stderr, "<column_groups> must be between 1 and %d\n", ATTR_PER_RECORD);
+        exit(1);
     }
 
-    if (chdir(argv[2]) == -1)
+    //a sort attribute makes a projection sorted on it
+    int sortAttr = (argc > 6) ? atoi(argv[6]) : -1;
+    if (argc > 6 && (sortAttr < 0 || sortAttr >= ATTR_PER_RECORD))
     {
-        fprintf(stderr, "Could not navigate to storage directory: %s\n", argv[2]);
+        fprintf(stderr, "<sort_attribute> must be between 0 and %d\n", ATTR_PER_RECORD - 1);
         exit(1);
     }
 
     int pageSize = atoi(argv[3]);
+    if (pageSize < ATTRIBUTE_SIZE)
+    {
+        fprintf(stderr, "<pagesize> must hold at least one value\n");
+        exit(1);
+    }
 
-    std::vector<Heapfile> attributeFiles;
-    std::vector<Page> workingPages; 
-    std::vector<int> workingPageIDs;
-
-    char filename[3];
-
-    for (int i = 0 ; i < ATTR_PER_RECORD; i++)
+    //the column store is a single file of row groups with a footer
+    FILE *file = fopen(argv[2], "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not create column store: %s\n", argv[2]);
+        exit(1);
+    }
+    //bitmap indexes built on an earlier column store of this name no longer apply
+    remove_bitmap_indexes(argv[2]);
+    ColstoreWriter writer;
+    init_colstore_writer(&writer, file, pageSize, sortAttr);
+    BloomFilters bloom;
+    if (!bloomAttrs.empty())
     {
-        sprintf(filename, "%d", i);
-        FILE *file = fopen(filename, "wb+r"); 
-        Heapfile *hpFile = new Heapfile();
-        init_heapfile(hpFile, pageSize, file);
+        init_bloom_filters(&bloom, pageSize / ATTRIBUTE_SIZE, bloomAttrs);
+        writer.bloom = &bloom;
+    }
 
-        int pageID = alloc_page(hpFile);
+    // Rows are parsed in parallel and split into columns in file order.
+    ColumnState state;
+    state.writer = &writer;
+    state.numGroups = numGroups;
+    state.sortAttr = sortAttr;
+    if (parallel_load_csv(argv[1], numThreads, store_rows, &state) == -1)
+    {
+        fprintf(stderr, "Cannot open CSV file: %s", argv[1]);
+        exit(1);
+    }
+    if (sortAttr >= 0)
+    {
+        store_sorted(&state);
+    }
 
-        Page *curPage = new Page();
-        init_fixed_len_page(curPage, pageSize, ATTRIBUTE_SIZE);
+    //cleanup: write the last row group and the footer
+    finish_colstore_writer(&writer);
 
-        attributeFiles.push_back(*hpFile); //line-up heapfiles with Pages
-        workingPages.push_back(*curPage);
-        workingPageIDs.push_back(pageID);
+    //the Bloom filters of every page go to a sidecar next to the store
+    std::string bloomName = bloom_path(argv[2]);
+    if (bloomAttrs.empty())
+    {
+        remove(bloomName.c_str());
+    }
+    else
+    {
+        FILE *bloomFile = fopen(bloomName.c_str(), "wb");
+        if (bloomFile == NULL)
+        {
+            fprintf(stderr, "Could not create Bloom filters: %s\n", bloomName.c_str());
+            exit(1);
+        }
+        write_bloom_filters(&bloom, bloomFile);
+        fclose(bloomFile);
+        free_bloom_filters(&bloom);
     }
 
-	//cout << "Finished initializing structures" << endl;
+    long *pages = writer.encoded_pages;
+    fprintf(stdout, "ENCODING: %lu bytes of values stored in %lu bytes "
+        "(pages: %ld plain, %ld dict, %ld rle, %ld packed)\n",
+        (unsigned long) writer.plain_bytes, (unsigned long) writer.offset,
+        pages[ENCODING_PLAIN], pages[ENCODING_DICT], pages[ENCODING_RLE], pages[ENCODING_PACKED]);
 
-    // can either:
-    // initialize 100 Heap files, keep them in a vector
-    // every time we read an attribute, move to a different heap file
-    // also need array of page pointers to update as we read attribute by attribute
-    // (make sure slot_size is only size of 1 attribute)
-    // when page is full write out to disk, replace entry in page array...? 
+    fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
 
+    return 0;
+}
 
-    string line;
+/**
+ * Append parsed rows to the column store. When sorting, they are kept
+ * in the current run, which is spilled once it holds SORT_RUN_ROWS rows.
+ */
+void store_rows(char *rows, int num_rows, void *arg)
+{
+    ColumnState *state = (ColumnState *) arg;
+    if (state->sortAttr < 0)
+    {
+        colstore_append_rows(state->writer, rows, num_rows, state->numGroups);
+        return;
+    }
+    while (num_rows > 0)
+    {
+        int count = std::min(num_rows, SORT_RUN_ROWS - (int) (state->rows.size() / (SLOT_SIZE)));
+        state->rows.insert(state->rows.end(), rows, rows + (size_t) count * SLOT_SIZE);
+        rows += (size_t) count * SLOT_SIZE;
+        num_rows -= count;
+        if (state->rows.size() / (SLOT_SIZE) == SORT_RUN_ROWS)
+        {
+            spill_run(state);
+        }
+    }
+}
 
-    while (getline(csvfile, line)) {
-		int attrInd = 0; //index/"attributeID"
-		int len = strlen(line.c_str());
-        char *temp = (char *) malloc(len + 1);
-		memset(temp, '\0', len+1);
-        strncpy(temp, line.c_str(), len);
+/**
+ * Order the rows of the current run by the sort attribute. Rows with
+ * equal values keep their file order.
+ */
+void sort_run(ColumnState *state, std::vector<int> *order)
+{
+    int numRows = state->rows.size() / (SLOT_SIZE);
+    order->resize(numRows);
+    for (int i = 0; i < numRows; i++)
+    {
+        order->at(i) = i;
+    }
+    RowOrder byAttr = {state->rows.data(), state->sortAttr};
+    std::stable_sort(order->begin(), order->end(), byAttr);
+}
 
-        char *buf;
-        buf = strtok (temp, ",");
-		//cout << "Finished string business" << endl;
-        while (buf != NULL)
+/**
+ * Write the current run, sorted, to a temporary file and empty it.
+ */
+void spill_run(ColumnState *state)
+{
+    std::vector<int> order;
+    sort_run(state, &order);
+    FILE *file = tmpfile();
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not create a temporary file for sorting\n");
+        exit(1);
+    }
+    for (int i = 0; i < order.size(); i++)
+    {
+        if (fwrite(&state->rows[(size_t) order[i] * SLOT_SIZE], SLOT_SIZE, 1, file) != 1)
         {
-            Page *curPage = &workingPages[attrInd];
-            Heapfile *curFile = &attributeFiles[attrInd];
-
-            Record *rec = new Record();
-            fixed_len_read(buf, ATTRIBUTE_SIZE, rec);
+            fprintf(stderr, "Could not write a sorted run\n");
+            exit(1);
+        }
+    }
+    rewind(file);
+    state->runs.push_back(file);
+    state->rows.clear();
+}
 
-			//test test
-			//cout << "Record entries are: " << endl; 
-			//for (int i = 0; i < rec->size(); i++)
-				//cout << rec->at(i) << endl;
+/**
+ * Read the next rows of a spilled run. Returns false once it is exhausted.
+ */
+bool fill_run(SortRun *run)
+{
+    run->count = fread(run->rows.data(), SLOT_SIZE, MERGE_BUFFER_ROWS, run->file);
+    run->next = 0;
+    return run->count > 0;
+}
 
-            if (add_fixed_len_page(curPage, rec) == -1) //page full do smthg
+/**
+ * Append the kept rows in order of the sort attribute. An input that fit
+ * in one run is appended straight from memory; otherwise the spilled runs
+ * are merged, so at most one run is in memory at a time.
+ */
+void store_sorted(ColumnState *state)
+{
+    std::vector<char> batch((size_t) APPEND_BATCH_ROWS * SLOT_SIZE);
+    if (state->runs.empty())
+    {
+        std::vector<int> order;
+        sort_run(state, &order);
+        for (int first = 0; first < order.size(); first += APPEND_BATCH_ROWS)
+        {
+            int count = std::min(APPEND_BATCH_ROWS, (int) order.size() - first);
+            for (int i = 0; i < count; i++)
             {
-				//cout << "Doing page full stuff" << endl;
-                write_page(curPage, curFile, workingPageIDs[attrInd]);
-
-				//cout << "Page written successfully" << endl;
-
-                int newPageId = alloc_page(curFile);
-
-				//cout << "Page allocated successfully" << endl;
-
-                Page *newPage = new Page();
-                init_fixed_len_page(newPage, pageSize, ATTRIBUTE_SIZE);
-                add_fixed_len_page(newPage, rec);
-
-				//cout << "New page initialized" << endl;
-
-                workingPages[attrInd] = *newPage;
-                workingPageIDs[attrInd] = newPageId;
-                
+                memcpy(&batch[(size_t) i * SLOT_SIZE], &state->rows[(size_t) order[first + i] * SLOT_SIZE], SLOT_SIZE);
             }
-
-            //attrInd = (attrInd + 1) % ATTR_PER_RECORD;
-			attrInd++;
-
-            buf = strtok (NULL, ",");
+            colstore_append_rows(state->writer, batch.data(), count, state->numGroups);
         }
+        std::vector<char>().swap(state->rows);
+        return;
     }
-
-    //cleanup: write all the pages and close all the files
-    for (int i = 0; i < ATTR_PER_RECORD; i++)
+    if (!state->rows.empty())
     {
-        Page *curPage = &workingPages[i];
-        Heapfile *curFile = &attributeFiles[i];
-        write_page(curPage, curFile, workingPageIDs[i]);
-
-        fflush(curFile->file_ptr);
-        fclose(curFile->file_ptr);
+        spill_run(state);
+    }
+    std::vector<char>().swap(state->rows);
 
+    std::vector<SortRun> runs(state->runs.size());
+    RunOrder byNextRow = {&runs, state->sortAttr};
+    std::priority_queue<int, std::vector<int>, RunOrder> heap(byNextRow);
+    for (int r = 0; r < runs.size(); r++)
+    {
+        runs[r].file = state->runs[r];
+        runs[r].rows.resize((size_t) MERGE_BUFFER_ROWS * SLOT_SIZE);
+        if (fill_run(&runs[r]))
+        {
+            heap.push(r);
+        }
     }
 
-    int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
-    fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
+    int count = 0;
+    while (!heap.empty())
+    {
+        int r = heap.top();
+        heap.pop();
+        SortRun *run = &runs[r];
+        memcpy(&batch[(size_t) count * SLOT_SIZE], &run->rows[(size_t) run->next * SLOT_SIZE], SLOT_SIZE);
+        if (++count == APPEND_BATCH_ROWS)
+        {
+            colstore_append_rows(state->writer, batch.data(), count, state->numGroups);
+            count = 0;
+        }
+        if (++run->next < run->count || fill_run(run))
+        {
+            heap.push(r);
+        }
+    }
+    if (count > 0)
+    {
+        colstore_append_rows(state->writer, batch.data(), count, state->numGroups);
+    }
 
-    return 0;
+    for (int r = 0; r < runs.size(); r++)
+    {
+        fclose(runs[r].file);
+    }
+    state->runs.clear();
 }
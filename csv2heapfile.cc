@@ -6,63 +6,200 @@
 #include <stdlib.h>
 #include <cstring>
 #include <assert.h>
+#include <thread>
+#include <chrono>
 #include "library.h"
 
 using namespace std;
 
 void check_argv(int argc, char *argv[]);
+int parse_attr_options(int argc, char *argv[], vector<int> *zone_attrs, vector<int> *bloom_attrs);
+void load_rows(char *rows, int num_rows, void *arg);
+
+#define PIPELINE_PAGES 64
+
+typedef chrono::steady_clock Clock;
+
+typedef struct {
+    BulkLoader loader;
+    Page *page;     // page being filled by the parser
+    int num_words;
+    PageID pid;
+
+    // Pipelined mode: the parser hands full pages to a writer thread
+    // through full_pages and takes empty ones back from free_pages.
+    bool pipelined;
+    SpscRing full_pages;
+    SpscRing free_pages;
+    Clock::duration parser_wait;
+    Clock::duration writer_wait;
+    Clock::duration writer_time;
+} LoadState;
+
+void emit_page(LoadState *state);
+void write_pages(LoadState *state);
 
 int main(int argc, char *argv[]) {
+    vector<int> zone_attrs;
+    vector<int> bloom_attrs;
+    argc = parse_attr_options(argc, argv, &zone_attrs, &bloom_attrs);
     check_argv(argc, argv);
 
     char *csv_file = argv[1];
     char *heapfile_name = argv[2];
     int page_size = atoi(argv[3]);
+    int num_threads = (argc > 4) ? atoi(argv[4]) : 1;
 
     //start timer
-    clock_t start = clock();
+    long start = wall_clock_msec();
 
     // Initialize heap file.
     Heapfile *heapfile = new Heapfile;
     init_heapfile(heapfile, page_size, fopen(heapfile_name , "rb+"));
+    // Indexes built on an earlier heapfile of this name no longer apply.
+    remove_indexes(heapfile_name);
+    if (zone_attrs.empty()) {
+        remove((string(heapfile_name) + ZONE_MAP_SUFFIX).c_str());
+    } else if (!open_zone_map(heapfile, heapfile_name, &zone_attrs)) {
+        fputs("zone map can't be created.\n", stderr);
+        exit(2);
+    }
+    if (bloom_attrs.empty()) {
+        remove(bloom_path(heapfile_name).c_str());
+    } else if (!open_bloom_filters(heapfile, heapfile_name, &bloom_attrs)) {
+        fputs("Bloom filters can't be created.\n", stderr);
+        exit(2);
+    }
+
+    // Pages are written sequentially, the directory and header once at the end.
+    LoadState state;
+    init_bulk_load(&state.loader, heapfile);
+    state.pid = 0;
+    state.pipelined = (argc > 5);
+    state.parser_wait = state.writer_wait = state.writer_time = Clock::duration::zero();
+
+    vector<Page> pages(state.pipelined ? PIPELINE_PAGES : 1);
+    for (int i = 0; i < pages.size(); i++) {
+        init_fixed_len_page(&pages[i], page_size, SLOT_SIZE);
+    }
+    state.page = &pages[0];
+    state.num_words = slot_bitmap_words(fixed_len_page_capacity(state.page));
 
-    if (!ifstream(csv_file))
-    {
+    thread writer;
+    if (state.pipelined) {
+        init_ring(&state.full_pages, PIPELINE_PAGES);
+        init_ring(&state.free_pages, PIPELINE_PAGES);
+        for (int i = 1; i < pages.size(); i++) {
+            ring_push(&state.free_pages, &pages[i]);
+        }
+        writer = thread(write_pages, &state);
+    }
+    Clock::time_point parse_start = Clock::now();
+
+    if (parallel_load_csv(csv_file, num_threads, load_rows, &state) == -1) {
         fputs("csv file doesn't exist.\n", stderr);
         exit(2);
     }
-    ifstream file(csv_file);
-    int pid;
-    int old_pid = 0;
-    while (1) {
-        Page *page = (Page *) malloc(sizeof(Page));
-        init_fixed_len_page(page, page_size, SLOT_SIZE);
+    if (fixed_len_page_freeslots(state.page) < fixed_len_page_capacity(state.page)) {
+        emit_page(&state);
+    }
 
-        read_csv2page(&file, page);
-        if (file.eof()) {
-            free(page->data);
-            free(page);
-            break;
+    if (state.pipelined) {
+        // A NULL page tells the writer that parsing is done.
+        while (!ring_push(&state.full_pages, NULL)) {
+            this_thread::yield();
         }
-        pid = alloc_page(heapfile);
-        write_page(page, heapfile, pid);
+        Clock::duration parser_time = Clock::now() - parse_start;
+        writer.join();
+        free_ring(&state.full_pages);
+        free_ring(&state.free_pages);
+
+        double parser_busy = chrono::duration<double, milli>(parser_time - state.parser_wait).count();
+        double writer_busy = chrono::duration<double, milli>(state.writer_time - state.writer_wait).count();
+        fprintf(stdout, "PIPELINE: parser busy %.0f ms (%.0f%%), writer busy %.0f ms (%.0f%%)\n",
+                parser_busy, 100 * parser_busy / max(1.0, chrono::duration<double, milli>(parser_time).count()),
+                writer_busy, 100 * writer_busy / max(1.0, chrono::duration<double, milli>(state.writer_time).count()));
+    }
+    for (int i = 0; i < pages.size(); i++) {
+        free(pages[i].data);
+        free(pages[i].slot_bitmap);
+    }
+
+    finish_bulk_load(&state.loader);
+    cout << "numer of page is " << state.pid << endl;
+
+    close_heapfile(heapfile);
 
-        free(page->data);
-        free(page);
+    fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
+}
+
+/**
+ * Pack parsed rows into pages, handing each page on once it is full.
+ */
+void load_rows(char *rows, int num_rows, void *arg) {
+    LoadState *state = (LoadState *) arg;
+    for (int i = 0; i < num_rows; i++) {
+        if (add_fixed_len_slot(state->page, rows + (size_t) i * SLOT_SIZE) == -1) {
+            emit_page(state);
+            add_fixed_len_slot(state->page, rows + (size_t) i * SLOT_SIZE);
+        }
     }
-    cout << "numer of page is " << pid << endl;
+}
 
-    fflush(heapfile->file_ptr);
-    fclose(heapfile->file_ptr);
-    file.close();
+/**
+ * Append the current page to the heapfile, or queue it for the writer in
+ * pipelined mode, and continue with an empty page.
+ */
+void emit_page(LoadState *state) {
+    if (!state->pipelined) {
+        state->pid = bulk_load_page(&state->loader, state->page);
+    } else {
+        Clock::time_point wait_start = Clock::now();
+        bool waited = false;
+        while (!ring_push(&state->full_pages, state->page)) {
+            this_thread::yield();
+            waited = true;
+        }
+        void *page;
+        while (!ring_pop(&state->free_pages, &page)) {
+            this_thread::yield();
+            waited = true;
+        }
+        if (waited) {
+            state->parser_wait += Clock::now() - wait_start;
+        }
+        state->page = (Page *) page;
+    }
+    memset(state->page->slot_bitmap, 0, state->num_words * sizeof(uint64_t));
+}
 
-    int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
-    fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
+/**
+ * Writer stage of the pipelined mode.
+ */
+void write_pages(LoadState *state) {
+    Clock::time_point start = Clock::now();
+    while (1) {
+        void *page;
+        if (!ring_pop(&state->full_pages, &page)) {
+            Clock::time_point wait_start = Clock::now();
+            while (!ring_pop(&state->full_pages, &page)) {
+                this_thread::yield();
+            }
+            state->writer_wait += Clock::now() - wait_start;
+        }
+        if (page == NULL) {
+            break;
+        }
+        state->pid = bulk_load_page(&state->loader, (Page *) page);
+        ring_push(&state->free_pages, page);
+    }
+    state->writer_time = Clock::now() - start;
 }
 
 void check_argv(int argc, char *argv[]) {
-    if(argc != 4) {
-        fputs("usage: csv2heapfile <csv_file> <heapfile> <page_size>\n",stderr);
+    if(argc < 4 || argc > 6 || (argc == 6 && strcmp(argv[5], "pipelined") != 0)) {
+        fputs("usage: csv2heapfile <csv_file> <heapfile> <page_size> [<num_threads> [pipelined]] "
+              "[zonemap <attribute_id>[,<attribute_id>...]] [bloom <attribute_id>[,<attribute_id>...]]\n",stderr);
         exit(2);
     }
 
@@ -70,4 +207,37 @@ void check_argv(int argc, char *argv[]) {
         fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
         exit(2);
     }
+
+    if (argc > 4 && atoi(argv[4]) <= 0) {
+        fputs("usage: <num_threads> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
+}
+
+/**
+ * Take trailing "zonemap <attribute_id>[,<attribute_id>...]" and
+ * "bloom <attribute_id>[,<attribute_id>...]" options off the arguments,
+ * filling zone_attrs and bloom_attrs. Returns the number of arguments left.
+ */
+int parse_attr_options(int argc, char *argv[], vector<int> *zone_attrs, vector<int> *bloom_attrs) {
+    while (argc >= 3) {
+        vector<int> *attrs;
+        if (strcmp(argv[argc - 2], "zonemap") == 0) {
+            attrs = zone_attrs;
+        } else if (strcmp(argv[argc - 2], "bloom") == 0) {
+            attrs = bloom_attrs;
+        } else {
+            break;
+        }
+        for (char *name = strtok(argv[argc - 1], ","); name != NULL; name = strtok(NULL, ",")) {
+            int attr = atoi(name);
+            if ((attr <= 0 || attr >= ATTR_PER_RECORD) && strcmp(name, "0") != 0) {
+                fprintf(stderr, "usage: <attribute_id> must be integer and greater or equal to zero and smaller than number of attribute which is %d \n", ATTR_PER_RECORD);
+                exit(2);
+            }
+            attrs->push_back(attr);
+        }
+        argc -= 2;
+    }
+    return argc;
 }
@@ -9,8 +9,18 @@
 using namespace std;
 
 void check_argv(int argc, char *argv[]);
+void delete_batch(char *heapfile_name, char *ops_name, int page_size);
 
 int main(int argc, char *argv[]) {
+    if (argc == 5 && strcmp(argv[2], "batch") == 0) {
+        if (atoi(argv[4]) <= 0) {
+            fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
+            exit(2);
+        }
+        delete_batch(argv[1], argv[3], atoi(argv[4]));
+        return 0;
+    }
+
     char *argv2 = (char *) malloc(strlen(argv[2]) * sizeof(char));
     strcpy(argv2, argv[2]);
     check_argv(argc, argv);
@@ -26,13 +36,14 @@ int main(int argc, char *argv[]) {
     // Initialize heap file.
     Heapfile *heapfile = new Heapfile;
     FILE *f = fopen(heapfile_name, "rb+");
-    fread(heapfile, sizeof(Heapfile), 1, f);
-    heapfile->file_ptr = f;
-    heapfile->page_size = page_size;
-    if (heapfile->file_ptr == NULL) {
+    if (f == NULL) {
         fputs("heap file doesn't exist.\n", stderr);
         exit(2);
     }
+    open_heapfile(heapfile, page_size, f);
+    open_zone_map(heapfile, heapfile_name, NULL);
+    open_bloom_filters(heapfile, heapfile_name, NULL);
+    open_indexes(heapfile, heapfile_name);
 
     Page *page = new Page;
     if (pid > heapfile->number_of_page) {
@@ -45,21 +56,27 @@ int main(int argc, char *argv[]) {
         fputs("record with <record_id> doesn't exist.\n", stderr);
         exit(2);
     }
-    page->slot_info->at(slot) = '0';
+    if (slot_is_used(page, slot)) {
+        RecordID rid = {pid, slot};
+        update_indexes(heapfile, rid, (const char *) page->data + slot * page->slot_size, NULL);
+    }
+    set_slot_used(page, slot, false);
 
     write_page(page, heapfile, pid);
 
-    fflush(heapfile->file_ptr);
-    fclose(heapfile->file_ptr);
+    close_heapfile(heapfile);
     free(argv2);
 
+    print_buffer_pool_stats(stdout);
+
     int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
     fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
 }
 
 void check_argv(int argc, char *argv[]) {
     if(argc != 4) {
-        fputs("usage: delete <heapfile> <page_id>-<slot> <page_size>\n",stderr);
+        fputs("usage: delete <heapfile> <page_id>-<slot> <page_size>\n"
+              "       delete <heapfile> batch <ops_file> <page_size>\n",stderr);
         exit(2);
     }
 
@@ -79,4 +96,50 @@ void check_argv(int argc, char *argv[]) {
         fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
         exit(2);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Delete the records read from ops_name, or stdin if it is "-", one
+ * "<page_id>-<slot>" per line. They are grouped by page, so each page is
+ * read and written once however many of its records go.
+ */
+void delete_batch(char *heapfile_name, char *ops_name, int page_size) {
+    //start timer
+    clock_t start = clock();
+
+    FILE *ops_file = (strcmp(ops_name, "-") == 0) ? stdin : fopen(ops_name, "r");
+    if (ops_file == NULL) {
+        fputs("operations file doesn't exist.\n", stderr);
+        exit(2);
+    }
+    vector<RecordOp> ops;
+    if (!read_record_ops(ops_file, false, &ops)) {
+        exit(2);
+    }
+    if (ops_file != stdin) {
+        fclose(ops_file);
+    }
+
+    // Initialize heap file.
+    Heapfile *heapfile = new Heapfile;
+    FILE *f = fopen(heapfile_name, "rb+");
+    if (f == NULL) {
+        fputs("heap file doesn't exist.\n", stderr);
+        exit(2);
+    }
+    open_heapfile(heapfile, page_size, f);
+    open_zone_map(heapfile, heapfile_name, NULL);
+    open_bloom_filters(heapfile, heapfile_name, NULL);
+    open_indexes(heapfile, heapfile_name);
+
+    long applied = apply_record_ops(heapfile, &ops);
+    close_heapfile(heapfile);
+
+    fprintf(stdout, "BATCH: %ld operations applied, %lu on missing records skipped\n",
+            applied, (unsigned long) ops.size() - applied);
+
+    print_buffer_pool_stats(stdout);
+
+    int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+    fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
+}
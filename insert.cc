@@ -11,6 +11,7 @@
 using namespace std;
 
 void check_argv(int argc, char *argv[]);
+void insert_rows(char *rows, int num_rows, void *arg);
 
 int main(int argc, char *argv[]) {
     check_argv(argc, argv);
@@ -18,73 +19,64 @@ int main(int argc, char *argv[]) {
     char *heapfile_name = argv[1];
     char *csv_file = argv[2];
     int page_size = atoi(argv[3]);
+    int num_threads = (argc > 4) ? atoi(argv[4]) : 1;
 
     //start timer
-    clock_t start = clock();
+    long start = wall_clock_msec();
 
     // Initialize heap file.
     Heapfile *heapfile = new Heapfile;
     FILE *f = fopen(heapfile_name, "rb+");
-    fread(heapfile, sizeof(Heapfile), 1, f);
-    heapfile->file_ptr = f;
-    heapfile->page_size = page_size;
-    if (heapfile->file_ptr == NULL) {
+    if (f == NULL) {
         fputs("heap file doesn't exist.\n", stderr);
         exit(2);
     }
+    open_heapfile(heapfile, page_size, f);
+    open_zone_map(heapfile, heapfile_name, NULL);
+    open_bloom_filters(heapfile, heapfile_name, NULL);
+    open_indexes(heapfile, heapfile_name);
 
-    if (!ifstream(csv_file))
-    {
+    // Rows are parsed in parallel and inserted in file order.
+    if (parallel_load_csv(csv_file, num_threads, insert_rows, heapfile) == -1) {
         fputs("csv file doesn't exist.\n", stderr);
         exit(2);
     }
 
-    ifstream file(csv_file);
-    int pid = 1;
-    char chars_to_remove[] = ",\"";
-    string line;
-    Page *cur_page = new Page;
-    read_page(heapfile, pid, cur_page);
-    
-    while (getline(file, line)) {
-        for (int i = 0; i < strlen(chars_to_remove); ++i) {
-            line.erase(remove(line.begin(), line.end(), chars_to_remove[i]), line.end());
-        }
-        Record *record = new Record;
-        fixed_len_read((void *) line.c_str(), SLOT_SIZE, record);
+    close_heapfile(heapfile);
 
-        if (pid > heapfile->number_of_page) {
-            pid = alloc_page(heapfile);
-            read_page(heapfile, pid, cur_page);
-        }
+    print_buffer_pool_stats(stdout);
 
-        while (fixed_len_page_freeslots(cur_page) <= 0) {
-            write_page(cur_page, heapfile, pid);
-            free(cur_page->data);
-            cur_page = new Page;
-            pid++;
+    fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
+}
 
-            if (pid > heapfile->number_of_page) {
+void insert_rows(char *rows, int num_rows, void *arg) {
+    Heapfile *heapfile = (Heapfile *) arg;
+    for (int i = 0; i < num_rows; i++) {
+        int pid;
+        // The free space map points at a page with room, so only that page is read.
+        while (1) {
+            pid = find_free_page(heapfile);
+            if (pid == -1) {
                 pid = alloc_page(heapfile);
             }
-            read_page(heapfile, pid, cur_page);
+            Page *cur_page = pin_page(heapfile, pid);
+            int slot = add_fixed_len_slot(cur_page, rows + (size_t) i * SLOT_SIZE);
+            unpin_page(heapfile, pid, slot != -1);
+            if (slot != -1) {
+                RecordID rid = {pid, slot};
+                update_indexes(heapfile, rid, NULL, rows + (size_t) i * SLOT_SIZE);
+                break;
+            }
+            // Directory entry was stale; the page is actually full.
+            set_page_free_slots(heapfile, pid, 0);
         }
         cout << "insert record into page " << pid << endl;
-        add_fixed_len_page(cur_page, record);
     }
-    write_page(cur_page, heapfile, pid);
-
-    fflush(heapfile->file_ptr);
-    fclose(heapfile->file_ptr);
-    file.close();
-
-    int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
-    fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
 }
 
 void check_argv(int argc, char *argv[]) {
-    if(argc != 4) {
-        fputs("usage: insert <heapfile> <csv_file> <page_size>\n",stderr);
+    if(argc < 4 || argc > 5) {
+        fputs("usage: insert <heapfile> <csv_file> <page_size> [<num_threads>]\n",stderr);
         exit(2);
     }
 
@@ -92,4 +84,9 @@ void check_argv(int argc, char *argv[]) {
         fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
         exit(2);
     }
+
+    if (argc > 4 && atoi(argv[4]) <= 0) {
+        fputs("usage: <num_threads> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
 }
@@ -8,6 +8,18 @@
 #include <math.h>
 #include <assert.h>
 #include <stdint.h>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 #include "library.h"
 
 using namespace std;
@@ -17,9 +29,20 @@ int get_free_space_size(int page_size);
 int get_number_of_pages(int page_size);
 size_t fwrite_with_check(const void *ptr, size_t size, size_t count, FILE *file);
 size_t fread_with_check(void *ptr, size_t size, size_t count, FILE *file);
-uint32_t alloc_page_at_end(FILE *file, int page_size, bool dir_page);
+uint32_t alloc_page_at_end(FILE *file, int page_size, int slot_size, bool dir_page);
 int reach_page(Heapfile *heapfile, PageID pid);
-uint32_t read_offset(FILE *file);
+Page *fetch_frame(Heapfile *heapfile, PageID pid, bool load, int num_words);
+int find_victim();
+void drop_frames(Heapfile *heapfile);
+void load_directory(Heapfile *heapfile);
+void fsm_update(Heapfile *heapfile, PageID pid, int free_space);
+void bulk_append(BulkLoader *loader, const void *ptr, size_t size);
+void bulk_flush(BulkLoader *loader);
+bool pread_page(Heapfile *heapfile, int fd, PageID pid, char *buf, Page *page);
+void update_zone_map(Heapfile *heapfile, PageID pid, Page *page);
+void flush_zone_map(Heapfile *heapfile);
+void update_bloom_filters(Heapfile *heapfile, PageID pid, Page *page);
+void flush_bloom_filters(Heapfile *heapfile);
 
 /**
  * Compute the number of bytes required to serialize record
@@ -35,15 +58,16 @@ int fixed_len_sizeof(Record *record) {
 }
 
 /**
- * Serialize the record to a byte array to be stored in buf.
+ * Serialize the record to a byte array to be stored in buf. Every attribute
+ * takes exactly ATTRIBUTE_SIZE bytes; shorter values are padded with spaces.
  */
 void fixed_len_write(Record *record, void *buf) {
-    int pos = 0;
+    char *attr = (char *) buf;
     for (std::vector<V>::iterator it = record->begin(); it != record->end(); ++it) {
-        for (const char *i = *it; *i != '\0'; i++) {
-            *((char*) buf + pos) = *i;
-            pos++;
-        }
+        int len = strnlen(*it, ATTRIBUTE_SIZE);
+        memcpy(attr, *it, len);
+        memset(attr + len, ' ', ATTRIBUTE_SIZE - len);
+        attr += ATTRIBUTE_SIZE;
     }
 }
 
@@ -52,11 +76,15 @@ void fixed_len_write(Record *record, void *buf) {
  * stores the record in `record`.
  * Read attribute by attribute, since we are not assuming anything about what size is and whose multiple it could be of
  */
-void fixed_len_read(void *buf, int size, Record *record) {
+void fixed_len_read(void *buf, int size, Record *record, Arena *arena) {
     assert(size >= ATTRIBUTE_SIZE); //at least one attribute is being read
 
     while (size >= ATTRIBUTE_SIZE){
-        char *temp = (char *) malloc(ATTRIBUTE_SIZE + 1);
+        char *temp;
+        if (arena != NULL)
+            temp = (char *) arena_alloc(arena, ATTRIBUTE_SIZE + 1);
+        else
+            temp = (char *) malloc(ATTRIBUTE_SIZE + 1);
         memset(temp, '\0', ATTRIBUTE_SIZE + 1);
         strncpy(temp, (char *)buf, ATTRIBUTE_SIZE);
         record->push_back(temp);
@@ -75,199 +103,3732 @@ void init_fixed_len_page(Page *page, int page_size, int slot_size) {
     page->data = malloc(page_size);
     page->page_size = page_size;
     page->slot_size = slot_size;
-    page->slot_info = new ByteArray;
+    page->slot_bitmap = (uint64_t *) calloc(slot_bitmap_words(fixed_len_page_capacity(page)), sizeof(uint64_t));
+}
+
+/**
+ * Calculates the maximal number of records/slots that fit in a page
+ */
+int fixed_len_page_capacity(Page *page) {
+    return (page->page_size / page->slot_size);
+}
+
+/**
+ * Calculate the free space (number of free slots) in the page
+ */
+int fixed_len_page_freeslots(Page *page) {
+    int num_slots = fixed_len_page_capacity(page);
+    int num_used = 0;
+    for (int w = 0; w < slot_bitmap_words(num_slots); w++) {
+        num_used += __builtin_popcountll(page->slot_bitmap[w]);
+    }
+
+    return num_slots - num_used;
+}
+ 
+/**
+ * Add a record to the page
+ * Returns:
+ *   record slot offset if successful,
+ *   -1 if unsuccessful (page full)
+ */
+int add_fixed_len_page(Page *page, Record *r){
+    int ind = find_free_slot(page);
+    if (ind != -1) {
+        write_fixed_len_page(page, ind, r);
+        set_slot_used(page, ind, true);
+    }
+    return ind;
+}
+ 
+int add_fixed_len_slot(Page *page, const void *buf) {
+    int ind = find_free_slot(page);
+    if (ind != -1) {
+        memcpy((char *) page->data + ind * page->slot_size, buf, page->slot_size);
+        set_slot_used(page, ind, true);
+    }
+    return ind;
+}
+
+/**
+ * Write a record into a given slot.
+ */
+void write_fixed_len_page(Page *page, int slot, Record *r){
+    char *buf = ((char *)page->data + (slot * page->slot_size));
+    fixed_len_write(r, buf);
+}
+ 
+/**
+ * Read a record from the page from a given slot.
+ */
+void read_fixed_len_page(Page *page, int slot, Record *r, Arena *arena){
+    if (slot >= fixed_len_page_capacity(page) || !slot_is_used(page, slot))
+        return;
+
+    int slotSize = page->slot_size;
+
+    char *buf = ((char * )page->data + (slot * slotSize));
+    fixed_len_read(buf, slotSize, r, arena);
+}
+
+/**
+ * Point view at the record in the given slot without copying it.
+ */
+bool read_fixed_len_page_view(Page *page, int slot, RecordView *view) {
+    view->data = NULL;
+    view->len = 0;
+    if (slot >= fixed_len_page_capacity(page) || !slot_is_used(page, slot))
+        return false;
+
+    view->data = (const char *) page->data + slot * page->slot_size;
+    view->len = page->slot_size;
+    return true;
+}
+
+int record_view_size(RecordView *view) {
+    return view->len / ATTRIBUTE_SIZE;
+}
+
+AttrView record_view_attr(RecordView *view, int attr_id) {
+    AttrView attr;
+    attr.data = view->data + attr_id * ATTRIBUTE_SIZE;
+    attr.len = ATTRIBUTE_SIZE;
+    return attr;
+}
+
+/**
+ * Compare an attribute with a NUL-terminated value, like strcmp(attr, value).
+ */
+int compare_attr(AttrView attr, const char *value) {
+    int value_len = strlen(value);
+    int result = memcmp(attr.data, value, min(attr.len, value_len));
+    if (result != 0) {
+        return result;
+    }
+    return attr.len - value_len;
+}
+
+/**
+ * View of row i of the batch.
+ */
+RecordView batch_row(RecordBatch *batch, int i) {
+    RecordView view;
+    view.data = (const char *) batch->page->data + batch->slots[i] * batch->page->slot_size;
+    view.len = batch->page->slot_size;
+    return view;
+}
+
+/*
+ * Parallel scan: workers claim morsels from a shared counter and read their
+ * pages with pread. Finished morsel output is handed to the writer under a
+ * lock; in ordered mode it waits until every earlier morsel is written.
+ */
+typedef struct ScanState ScanState;
+struct ScanState {
+    Heapfile *heapfile;         // heapfile scan over pages, or every page if NULL
+    const vector<PageID> *pages;
+    Colstore *colstore;         // or column scan over column_pages
+    vector<ColumnPageInfo> column_pages;
+    int fd;
+    int page_size;
+    int slot_size;
+    int num_pages;
+    int morsel_size;
+    int num_morsels;
+    bool ordered;
+    PageCallback callback;
+    ColumnPageCallback column_callback;
+    void *arg;
+    FILE *out;
+
+    atomic<int> next_morsel;
+    atomic<long> total;
+    mutex out_lock;
+    vector<string> pending; // finished morsels waiting for earlier ones
+    vector<bool> done;
+    int next_to_write;
+};
+
+/**
+ * Read page pid with a single pread into buf, which must hold
+ * sizeof(Page) + bitmap + page_size bytes, and point page at it.
+ * page->slot_bitmap must already hold enough words.
+ */
+bool pread_page(Heapfile *heapfile, int fd, PageID pid, char *buf, Page *page) {
+    if (pid < 1 || pid > heapfile->page_offsets->size()) {
+        return false;
+    }
+    int bitmap_size = slot_bitmap_size(page);
+    size_t size = sizeof(Page) + bitmap_size + heapfile->page_size;
+    if (pread(fd, buf, size, heapfile->page_offsets->at(pid - 1)) != (ssize_t) size) {
+        fputs("Read error\n", stderr);
+        return false;
+    }
+
+    memcpy(page->slot_bitmap, buf + sizeof(Page), bitmap_size);
+    page->data = buf + sizeof(Page) + bitmap_size;
+    return true;
+}
+
+static void emit_morsel(ScanState *state, int morsel, string *output) {
+    lock_guard<mutex> guard(state->out_lock);
+    if (!state->ordered) {
+        fwrite(output->data(), 1, output->size(), state->out);
+        return;
+    }
+
+    state->pending[morsel].swap(*output);
+    state->done[morsel] = true;
+    while (state->next_to_write < state->num_morsels && state->done[state->next_to_write]) {
+        string *ready = &state->pending[state->next_to_write];
+        fwrite(ready->data(), 1, ready->size(), state->out);
+        string().swap(*ready);
+        state->next_to_write++;
+    }
+}
+
+static void scan_worker(ScanState *state) {
+    Page page;
+    page.page_size = state->page_size;
+    page.slot_size = state->slot_size;
+    int num_words = slot_bitmap_words(fixed_len_page_capacity(&page));
+    page.slot_bitmap = (uint64_t *) calloc(num_words, sizeof(uint64_t));
+    char *buf = (char *) malloc(max(sizeof(Page) + slot_bitmap_size(&page) + state->page_size,
+                                    (size_t) column_page_buffer_size(state->page_size)));
+
+    string output;
+    int morsel;
+    while ((morsel = state->next_morsel++) < state->num_morsels) {
+        long records = 0;
+        output.clear();
+
+        int first = morsel * state->morsel_size;
+        int last = min(state->num_pages, first + state->morsel_size);
+        for (int i = first; i < last; i++) {
+            if (state->colstore != NULL) {
+                EncodedPage encoded;
+                if (read_column_page(state->colstore, &state->column_pages[i], buf, &encoded)) {
+                    records += state->column_callback(&encoded, &output, state->arg);
+                }
+                continue;
+            }
+            PageID pid = (state->pages != NULL) ? state->pages->at(i) : i + 1;
+            if (pread_page(state->heapfile, state->fd, pid, buf, &page)) {
+                records += state->callback(&page, pid, &output, state->arg);
+            }
+        }
+        state->total += records;
+        emit_morsel(state, morsel, &output);
+    }
+
+    free(buf);
+    free(page.slot_bitmap);
+}
+
+/**
+ * Scan every page of the heapfile with num_threads workers.
+ */
+static long run_scan(ScanState *state, int num_threads, int morsel_size, bool ordered,
+                     void *arg, FILE *out);
+
+long parallel_scan(Heapfile *heapfile, int num_threads, int morsel_size, bool ordered,
+                   PageCallback callback, void *arg, FILE *out, const vector<PageID> *pages) {
+    assert(num_threads > 0 && morsel_size > 0);
+
+    // Workers read the file directly, so buffered changes must reach it first.
+    flush_heapfile(heapfile);
+    fflush(heapfile->file_ptr);
+
+    ScanState state;
+    state.heapfile = heapfile;
+    state.pages = pages;
+    state.colstore = NULL;
+    state.fd = fileno(heapfile->file_ptr);
+    state.page_size = heapfile->page_size;
+    state.slot_size = heapfile->slot_size;
+    state.num_pages = (pages != NULL) ? pages->size() : heapfile->number_of_page;
+    state.callback = callback;
+    return run_scan(&state, num_threads, morsel_size, ordered, arg, out);
+}
+
+long parallel_scan_column(Colstore *colstore, int attr, int num_threads, int morsel_size, bool ordered,
+                          ColumnPageCallback callback, void *arg, FILE *out,
+                          const char *start, const char *end, int len, BloomFilters *bloom) {
+    assert(num_threads > 0 && morsel_size > 0);
+
+    ScanState state;
+    state.heapfile = NULL;
+    state.pages = NULL;
+    state.colstore = colstore;
+    // On the sort attribute only the rows found by binary search are read.
+    uint64_t first_row = 0;
+    uint64_t last_row = colstore->num_rows;
+    bool sorted = start != NULL && colstore_sorted_rows(colstore, attr, start, end, len, &first_row, &last_row);
+    // An equality also skips pages whose Bloom filter rules the value out.
+    bool equality = bloom != NULL && start != NULL && len == ATTRIBUTE_SIZE && memcmp(start, end, len) == 0;
+    long page_index = 0;
+    for (int g = 0; g < colstore->row_groups->size(); g++) {
+        vector<ColumnPageInfo> *chunk = &colstore->row_groups->at(g).chunks[attr];
+        uint64_t row = colstore->row_groups->at(g).first_row;
+        for (int p = 0; p < chunk->size(); row += chunk->at(p).num_values, p++, page_index++) {
+            if (equality && !bloom_may_contain(bloom, attr, page_index, start)) {
+                continue;
+            }
+            if (sorted ? (row >= first_row && row < last_row)
+                       : (start == NULL || column_page_may_match(&chunk->at(p), start, end, len))) {
+                state.column_pages.push_back(chunk->at(p));
+            }
+        }
+    }
+    state.fd = fileno(colstore->file_ptr);
+    state.page_size = colstore->page_size;
+    state.slot_size = ATTRIBUTE_SIZE;
+    state.num_pages = state.column_pages.size();
+    state.column_callback = callback;
+    return run_scan(&state, num_threads, morsel_size, ordered, arg, out);
+}
+
+static long run_scan(ScanState *state, int num_threads, int morsel_size, bool ordered,
+                     void *arg, FILE *out) {
+    state->morsel_size = morsel_size;
+    state->num_morsels = (state->num_pages + morsel_size - 1) / morsel_size;
+    state->ordered = ordered;
+    state->arg = arg;
+    state->out = out;
+    state->next_morsel = 0;
+    state->total = 0;
+    state->pending.resize(state->num_morsels);
+    state->done.resize(state->num_morsels, false);
+    state->next_to_write = 0;
+
+    vector<thread> workers;
+    for (int i = 0; i < num_threads; i++) {
+        workers.push_back(thread(scan_worker, state));
+    }
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].join();
+    }
+    fflush(out);
+
+    return state->total;
+}
+
+long wall_clock_msec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+/**
+ * Range predicate kernels.
+ */
+typedef void (*RangeMatchKernel)(const char *, int, const char *, const char *, int, uint64_t *);
+
+static RangeMatchKernel pick_range_kernel() {
+#ifdef HAVE_X86_SIMD
+    return cpu_has_avx2() ? range_match_avx2 : range_match_sse2;
+#else
+    return range_match_scalar;
+#endif
+}
+
+void range_match(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    // Scan threads call this concurrently; a local static is initialized once.
+    static const RangeMatchKernel kernel = pick_range_kernel();
+    kernel(values, count, start, end, len, match);
+}
+
+void range_match_scalar(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    memset(match, 0, ((count + 63) / 64) * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        if (memcmp(start, value, len) <= 0 && memcmp(end, value, len) >= 0) {
+            match[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+}
+
+bool cpu_has_avx2() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The SIMD kernels compare a whole value against start and end at once.
+ * For each bound, the lowest byte (within len) where value and bound
+ * differ decides the comparison; no differing byte means equal. Bytes are
+ * compared unsigned, as memcmp does, by flipping their sign bit.
+ * A 16-byte load reads past the value, so the values too close to the end
+ * of the buffer are left to the scalar kernel.
+ */
+#define SIMD_TAIL_VALUES ((16 - ATTRIBUTE_SIZE + ATTRIBUTE_SIZE - 1) / ATTRIBUTE_SIZE)
+static_assert(ATTRIBUTE_SIZE <= 16, "SIMD range kernels load one value per 16 bytes");
+
+static inline uint32_t range_bits(uint32_t ne_start, uint32_t gt_start, uint32_t ne_end, uint32_t lt_end) {
+    uint32_t first_start = ne_start & (0 - ne_start);
+    uint32_t first_end = ne_end & (0 - ne_end);
+    bool ge_start = ne_start == 0 || (gt_start & first_start) != 0;
+    bool le_end = ne_end == 0 || (lt_end & first_end) != 0;
+    return ge_start && le_end;
+}
+
+void range_match_sse2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    memset(match, 0, ((count + 63) / 64) * sizeof(uint64_t));
+
+    char start_buf[16], end_buf[16];
+    memset(start_buf, 0, 16);
+    memset(end_buf, 0, 16);
+    memcpy(start_buf, start, len);
+    memcpy(end_buf, end, len);
+
+    const __m128i sign = _mm_set1_epi8((char) 0x80);
+    const __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *) start_buf), sign);
+    const __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *) end_buf), sign);
+    const uint32_t len_mask = (1u << len) - 1;
+
+    int vector_count = count - SIMD_TAIL_VALUES;
+    int i = 0;
+    for (; i < vector_count; i++) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (values + i * ATTRIBUTE_SIZE)), sign);
+        uint32_t ne_start = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, lo)) & len_mask;
+        uint32_t gt_start = _mm_movemask_epi8(_mm_cmpgt_epi8(v, lo));
+        uint32_t ne_end = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, hi)) & len_mask;
+        uint32_t lt_end = _mm_movemask_epi8(_mm_cmpgt_epi8(hi, v));
+
+        match[i / 64] |= (uint64_t) range_bits(ne_start, gt_start, ne_end, lt_end) << (i % 64);
+    }
+    for (; i < count; i++) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        if (memcmp(start, value, len) <= 0 && memcmp(end, value, len) >= 0) {
+            match[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void range_match_avx2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    memset(match, 0, ((count + 63) / 64) * sizeof(uint64_t));
+
+    char start_buf[16], end_buf[16];
+    memset(start_buf, 0, 16);
+    memset(end_buf, 0, 16);
+    memcpy(start_buf, start, len);
+    memcpy(end_buf, end, len);
+
+    // Two values per register: value i in the low lane, value i + 1 in the high lane.
+    const __m256i sign = _mm256_set1_epi8((char) 0x80);
+    const __m256i lo = _mm256_xor_si256(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) start_buf)), sign);
+    const __m256i hi = _mm256_xor_si256(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) end_buf)), sign);
+    const uint32_t len_mask = (1u << len) - 1;
+
+    int vector_count = count - SIMD_TAIL_VALUES;
+    int i = 0;
+    for (; i + 1 < vector_count; i += 2) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) value)),
+            _mm_loadu_si128((const __m128i *) (value + ATTRIBUTE_SIZE)), 1);
+        v = _mm256_xor_si256(v, sign);
+
+        uint32_t ne_start = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lo));
+        uint32_t gt_start = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, lo));
+        uint32_t ne_end = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, hi));
+        uint32_t lt_end = _mm256_movemask_epi8(_mm256_cmpgt_epi8(hi, v));
+
+        uint64_t bits = range_bits(ne_start & len_mask, gt_start, ne_end & len_mask, lt_end)
+            | (uint64_t) range_bits((ne_start >> 16) & len_mask, gt_start >> 16, (ne_end >> 16) & len_mask, lt_end >> 16) << 1;
+        match[i / 64] |= bits << (i % 64);
+    }
+    for (; i < count; i++) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        if (memcmp(start, value, len) <= 0 && memcmp(end, value, len) >= 0) {
+            match[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+}
+#else
+void range_match_sse2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    range_match_scalar(values, count, start, end, len, match);
+}
+
+void range_match_avx2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match) {
+    range_match_scalar(values, count, start, end, len, match);
+}
+#endif
+
+void init_ring(SpscRing *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    ring->slots = (void **) calloc(size, sizeof(void *));
+    ring->mask = size - 1;
+    ring->head.store(0);
+    ring->tail.store(0);
+}
+
+bool ring_push(SpscRing *ring, void *item) {
+    size_t tail = ring->tail.load(memory_order_relaxed);
+    if (tail - ring->head.load(memory_order_acquire) > ring->mask) {
+        return false;
+    }
+    ring->slots[tail & ring->mask] = item;
+    ring->tail.store(tail + 1, memory_order_release);
+    return true;
+}
+
+bool ring_pop(SpscRing *ring, void **item) {
+    size_t head = ring->head.load(memory_order_relaxed);
+    if (head == ring->tail.load(memory_order_acquire)) {
+        return false;
+    }
+    *item = ring->slots[head & ring->mask];
+    ring->head.store(head + 1, memory_order_release);
+    return true;
+}
+
+void free_ring(SpscRing *ring) {
+    free(ring->slots);
+}
+
+/**
+ * Initialize an empty arena that grows in blocks of block_size bytes.
+ */
+void init_arena(Arena *arena, size_t block_size) {
+    arena->blocks = new vector<char *>;
+    arena->large = new vector<char *>;
+    arena->block_size = block_size;
+    arena->cur_block = -1;
+    arena->used = block_size;
+}
+
+/**
+ * Allocate size bytes from the arena.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~((size_t) 7);
+    if (size > arena->block_size) {
+        char *block = (char *) malloc(size);
+        arena->large->push_back(block);
+        return block;
+    }
+
+    if (arena->used + size > arena->block_size) {
+        arena->cur_block++;
+        if (arena->cur_block == arena->blocks->size()) {
+            char *block = (char *) malloc(arena->block_size);
+            if (block == NULL) {
+                fputs("Memory error\n", stderr);
+                exit(2);
+            }
+            arena->blocks->push_back(block);
+        }
+        arena->used = 0;
+    }
+
+    void *result = arena->blocks->at(arena->cur_block) + arena->used;
+    arena->used += size;
+    return result;
+}
+
+/**
+ * Release everything allocated from the arena at once.
+ */
+void reset_arena(Arena *arena) {
+    for (int i = 0; i < arena->large->size(); i++) {
+        free(arena->large->at(i));
+    }
+    arena->large->clear();
+    arena->cur_block = -1;
+    arena->used = arena->block_size;
+}
+
+/**
+ * Return all memory held by the arena.
+ */
+void free_arena(Arena *arena) {
+    reset_arena(arena);
+    for (int i = 0; i < arena->blocks->size(); i++) {
+        free(arena->blocks->at(i));
+    }
+    delete arena->blocks;
+    delete arena->large;
+}
+
+/**
+ * Initalize a heapfile to use the file and page size given.
+ */
+void init_heapfile(Heapfile *heapfile, int page_size, FILE *file) {
+    heapfile->page_size = page_size;
+    heapfile->number_of_page = 0;
+
+    Page *first_page = new Page();
+    init_fixed_len_page(first_page, page_size, SLOT_SIZE);
+    memset(first_page->data, 0, page_size);
+
+    fwrite(heapfile, HEAPFILE_HEADER_SIZE, 1, file);
+    fwrite(first_page, sizeof(Page), 1, file);
+    fwrite(first_page->data, page_size, 1, file);
+
+    free(first_page->data);
+
+    heapfile->file_ptr = file;
+    heapfile->dir_offsets = new vector<uint32_t>(1, HEAPFILE_HEADER_SIZE);
+    heapfile->page_offsets = new vector<uint32_t>;
+    heapfile->slot_size = SLOT_SIZE;
+    heapfile->free_space_map = new FreeSpaceMap;
+    heapfile->zone_map = NULL;
+    heapfile->bloom = NULL;
+    heapfile->indexes = new vector<BTree *>;
+    heapfile->hash_indexes = new vector<HashIndex *>;
+}
+
+/**
+ * Allocate another page in the heapfile.  This grows the file by a page.
+ */
+PageID alloc_page(Heapfile *heapfile) {
+    int page_size = heapfile->page_size;
+    int pid = heapfile->number_of_page + 1;
+    FILE *file = heapfile->file_ptr;
+
+    int number_of_pages_per_dir = get_number_of_pages(page_size);
+    int nth_dir = (pid - 1) / number_of_pages_per_dir;
+    int order_in_dir = (pid - 1) % number_of_pages_per_dir;
+
+    vector<uint32_t> *dirs = heapfile->dir_offsets;
+    if (nth_dir == dirs->size()) {
+        // Chain a new directory page after the last one.
+        uint32_t next_dir_offset = alloc_page_at_end(file, page_size, SLOT_SIZE, true);
+        fseek(file, dirs->back() + sizeof(Page), SEEK_SET);
+        fwrite_with_check(&next_dir_offset, OFFSET_SIZE, 1, file);
+        dirs->push_back(next_dir_offset);
+    }
+
+    uint32_t offset = alloc_page_at_end(file, page_size, heapfile->slot_size, false);
+
+    // Create new entry. Free space is counted in whole slots, as set_page_free_slots does.
+    int free_space = (page_size / heapfile->slot_size) * heapfile->slot_size;
+    fseek(file, dirs->at(nth_dir) + sizeof(Page) + OFFSET_SIZE + order_in_dir * get_entry_size(page_size), SEEK_SET);
+    fwrite_with_check(&offset, OFFSET_SIZE, 1, file);
+    fwrite_with_check(&free_space, get_free_space_size(page_size), 1, file);
+
+    heapfile->page_offsets->push_back(offset);
+    heapfile->number_of_page = pid;
+    fsm_update(heapfile, pid, free_space);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(heapfile, HEAPFILE_HEADER_SIZE, 1, file);
+
+    return heapfile->number_of_page;
+}
+
+void init_bulk_load(BulkLoader *loader, Heapfile *heapfile, size_t buffer_size) {
+    if (heapfile->number_of_page != 0) {
+        fputs("Bulk load needs an empty heapfile\n", stderr);
+        exit(2);
+    }
+    loader->heapfile = heapfile;
+    loader->buf_size = buffer_size;
+    loader->buf = (char *) malloc(loader->buf_size);
+    loader->used = 0;
+    loader->dirs = new vector<char *>(1, (char *) calloc(heapfile->page_size, 1));
+
+    fseek(heapfile->file_ptr, 0, SEEK_END);
+}
+
+PageID bulk_load_page(BulkLoader *loader, Page *page) {
+    Heapfile *heapfile = loader->heapfile;
+    int page_size = heapfile->page_size;
+    int pid = heapfile->number_of_page + 1;
+    int number_of_pages_per_dir = get_number_of_pages(page_size);
+    int nth_dir = (pid - 1) / number_of_pages_per_dir;
+    int order_in_dir = (pid - 1) % number_of_pages_per_dir;
+    uint32_t end = ftell(heapfile->file_ptr) + loader->used;
+
+    vector<uint32_t> *dirs = heapfile->dir_offsets;
+    if (nth_dir == dirs->size()) {
+        // The directory page is filled in by finish_bulk_load.
+        Page dir_page;
+        memset(&dir_page, 0, sizeof(Page));
+        dir_page.page_size = page_size;
+        dir_page.slot_size = SLOT_SIZE;
+        char *dir = (char *) calloc(page_size, 1);
+        bulk_append(loader, &dir_page, sizeof(Page));
+        bulk_append(loader, dir, page_size);
+
+        memcpy(loader->dirs->back(), &end, OFFSET_SIZE);
+        loader->dirs->push_back(dir);
+        dirs->push_back(end);
+        end += sizeof(Page) + page_size;
+    }
+
+    bulk_append(loader, page, sizeof(Page));
+    bulk_append(loader, page->slot_bitmap, slot_bitmap_size(page));
+    bulk_append(loader, page->data, page_size);
+
+    int free_space = fixed_len_page_freeslots(page) * page->slot_size;
+    char *entry = loader->dirs->at(nth_dir) + OFFSET_SIZE + order_in_dir * get_entry_size(page_size);
+    memcpy(entry, &end, OFFSET_SIZE);
+    memcpy(entry + OFFSET_SIZE, &free_space, get_free_space_size(page_size));
+
+    heapfile->page_offsets->push_back(end);
+    heapfile->number_of_page = pid;
+    fsm_update(heapfile, pid, free_space);
+    update_zone_map(heapfile, pid, page);
+    update_bloom_filters(heapfile, pid, page);
+    return pid;
+}
+
+void finish_bulk_load(BulkLoader *loader) {
+    Heapfile *heapfile = loader->heapfile;
+    FILE *file = heapfile->file_ptr;
+    bulk_flush(loader);
+
+    for (int i = 0; i < loader->dirs->size(); i++) {
+        fseek(file, heapfile->dir_offsets->at(i) + sizeof(Page), SEEK_SET);
+        fwrite_with_check(loader->dirs->at(i), heapfile->page_size, 1, file);
+        free(loader->dirs->at(i));
+    }
+    fseek(file, 0, SEEK_SET);
+    fwrite_with_check(heapfile, HEAPFILE_HEADER_SIZE, 1, file);
+
+    delete loader->dirs;
+    free(loader->buf);
+}
+
+void init_colstore_writer(ColstoreWriter *writer, FILE *file, int page_size, int sort_attr) {
+    int values_per_page = page_size / ATTRIBUTE_SIZE;
+    int pages_per_group = max(1, COLSTORE_ROW_GROUP_SIZE / (SLOT_SIZE) / values_per_page);
+
+    writer->file_ptr = file;
+    writer->page_size = page_size;
+    writer->sort_attr = sort_attr;
+    writer->rows_per_group = pages_per_group * values_per_page;
+    writer->values = (char *) malloc((size_t) ATTR_PER_RECORD * writer->rows_per_group * ATTRIBUTE_SIZE);
+    writer->cursor = 0;
+    writer->offset = 0;
+    writer->row_groups = new vector<RowGroup>;
+    writer->page_buf = (char *) malloc(column_page_buffer_size(page_size));
+    memset(writer->encoded_pages, 0, sizeof(writer->encoded_pages));
+    writer->plain_bytes = 0;
+    writer->bloom = NULL;
+    if (writer->values == NULL) {
+        fputs("Memory error\n", stderr);
+        exit(2);
+    }
+}
+
+/**
+ * Copy columns [first, last) of num_rows rows into the chunk buffers,
+ * a tile of rows at a time so the tile stays in cache across columns.
+ */
+static void transpose_rows(ColstoreWriter *writer, const char *rows, int num_rows, int first, int last) {
+    const int tile_rows = 128;
+    for (int r = 0; r < num_rows; r += tile_rows) {
+        int count = min(tile_rows, num_rows - r);
+        for (int attr = first; attr < last; attr++) {
+            char *dest = writer->values + ((size_t) attr * writer->rows_per_group + writer->cursor + r) * ATTRIBUTE_SIZE;
+            const char *src = rows + (size_t) r * SLOT_SIZE + attr * ATTRIBUTE_SIZE;
+            for (int i = 0; i < count; i++) {
+                memcpy(dest + i * ATTRIBUTE_SIZE, src + (size_t) i * SLOT_SIZE, ATTRIBUTE_SIZE);
+            }
+        }
+    }
+}
+
+/**
+ * Smallest and largest of count values.
+ */
+static void column_page_range(const char *values, int count, char *min_value, char *max_value) {
+    const char *lo = values;
+    const char *hi = values;
+    for (int i = 1; i < count; i++) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        if (memcmp(value, lo, ATTRIBUTE_SIZE) < 0) {
+            lo = value;
+        } else if (memcmp(value, hi, ATTRIBUTE_SIZE) > 0) {
+            hi = value;
+        }
+    }
+    memcpy(min_value, lo, ATTRIBUTE_SIZE);
+    memcpy(max_value, hi, ATTRIBUTE_SIZE);
+}
+
+/**
+ * Write the buffered rows as a row group, one chunk per attribute.
+ */
+static void write_row_group(ColstoreWriter *writer) {
+    int values_per_page = writer->page_size / ATTRIBUTE_SIZE;
+    RowGroup group;
+    group.first_row = 0;
+    if (!writer->row_groups->empty()) {
+        group.first_row = writer->row_groups->back().first_row + writer->row_groups->back().num_rows;
+    }
+    group.num_rows = writer->cursor;
+    group.chunks.resize(ATTR_PER_RECORD);
+
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        const char *chunk = writer->values + (size_t) attr * writer->rows_per_group * ATTRIBUTE_SIZE;
+        for (int row = 0; row < writer->cursor; row += values_per_page) {
+            ColumnPageInfo info;
+            info.num_values = min(values_per_page, writer->cursor - row);
+            info.size = encode_column_page(chunk + (size_t) row * ATTRIBUTE_SIZE, info.num_values, writer->page_buf);
+            info.offset = writer->offset;
+            column_page_range(chunk + (size_t) row * ATTRIBUTE_SIZE, info.num_values, info.min, info.max);
+            if (writer->bloom != NULL && writer->bloom->filters[attr] != NULL) {
+                long page = writer->bloom->filters[attr]->size() / writer->bloom->words;
+                for (int i = 0; i < info.num_values; i++) {
+                    bloom_add(writer->bloom, attr, page, chunk + (size_t) (row + i) * ATTRIBUTE_SIZE);
+                }
+            }
+            fwrite_with_check(writer->page_buf, info.size, 1, writer->file_ptr);
+            group.chunks[attr].push_back(info);
+
+            writer->offset += info.size;
+            writer->encoded_pages[(int) writer->page_buf[0]]++;
+            writer->plain_bytes += info.num_values * ATTRIBUTE_SIZE;
+        }
+    }
+    writer->row_groups->push_back(group);
+    writer->cursor = 0;
+}
+
+void colstore_append_rows(ColstoreWriter *writer, const char *rows, int num_rows, int num_groups) {
+    while (num_rows > 0) {
+        int count = min(num_rows, writer->rows_per_group - writer->cursor);
+        if (num_groups <= 1) {
+            transpose_rows(writer, rows, count, 0, ATTR_PER_RECORD);
+        } else {
+            vector<thread> workers;
+            for (int g = 0; g < num_groups; g++) {
+                workers.push_back(thread(transpose_rows, writer, rows, count,
+                                         g * ATTR_PER_RECORD / num_groups, (g + 1) * ATTR_PER_RECORD / num_groups));
+            }
+            for (int g = 0; g < num_groups; g++) {
+                workers[g].join();
+            }
+        }
+        writer->cursor += count;
+        if (writer->cursor == writer->rows_per_group) {
+            write_row_group(writer);
+        }
+        rows += (size_t) count * SLOT_SIZE;
+        num_rows -= count;
+    }
+}
+
+void finish_colstore_writer(ColstoreWriter *writer) {
+    if (writer->cursor > 0) {
+        write_row_group(writer);
+    }
+
+    // Footer: page size, attribute count, row groups, sort attribute, then
+    // the pages of every chunk.
+    FILE *file = writer->file_ptr;
+    uint64_t footer_offset = writer->offset;
+    uint32_t header[4] = {(uint32_t) writer->page_size, ATTR_PER_RECORD, (uint32_t) writer->row_groups->size(),
+                          (uint32_t) writer->sort_attr};
+    fwrite_with_check(header, sizeof(header), 1, file);
+    for (int g = 0; g < writer->row_groups->size(); g++) {
+        RowGroup *group = &writer->row_groups->at(g);
+        fwrite_with_check(&group->num_rows, sizeof(uint32_t), 1, file);
+        for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+            uint32_t num_pages = group->chunks[attr].size();
+            fwrite_with_check(&num_pages, sizeof(uint32_t), 1, file);
+            if (num_pages > 0) {
+                fwrite_with_check(&group->chunks[attr][0], sizeof(ColumnPageInfo) * num_pages, 1, file);
+            }
+        }
+    }
+    uint32_t magic = COLSTORE_MAGIC;
+    fwrite_with_check(&footer_offset, sizeof(uint64_t), 1, file);
+    fwrite_with_check(&magic, sizeof(uint32_t), 1, file);
+    fclose(file);
+
+    free(writer->values);
+    free(writer->page_buf);
+    delete writer->row_groups;
+}
+
+bool open_colstore(Colstore *colstore, int page_size, FILE *file) {
+    uint64_t footer_offset;
+    uint32_t magic;
+    if (fseek(file, -(long) (sizeof(uint64_t) + sizeof(uint32_t)), SEEK_END) != 0
+        || fread(&footer_offset, sizeof(uint64_t), 1, file) != 1
+        || fread(&magic, sizeof(uint32_t), 1, file) != 1 || magic != COLSTORE_MAGIC) {
+        fputs("Not a column store\n", stderr);
+        return false;
+    }
+
+    uint32_t header[4];
+    fseek(file, footer_offset, SEEK_SET);
+    if (fread_with_check(header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    if (header[0] != page_size || header[1] != ATTR_PER_RECORD) {
+        fprintf(stderr, "Column store has page size %u and %u attributes\n", header[0], header[1]);
+        return false;
+    }
+
+    colstore->file_ptr = file;
+    colstore->page_size = page_size;
+    colstore->sort_attr = (int) header[3];
+    colstore->num_rows = 0;
+    colstore->row_groups = new vector<RowGroup>(header[2]);
+    for (int g = 0; g < header[2]; g++) {
+        RowGroup *group = &colstore->row_groups->at(g);
+        fread_with_check(&group->num_rows, sizeof(uint32_t), 1, file);
+        group->first_row = colstore->num_rows;
+        group->chunks.resize(ATTR_PER_RECORD);
+        for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+            uint32_t num_pages = 0;
+            fread_with_check(&num_pages, sizeof(uint32_t), 1, file);
+            group->chunks[attr].resize(num_pages);
+            if (num_pages > 0) {
+                fread_with_check(&group->chunks[attr][0], sizeof(ColumnPageInfo) * num_pages, 1, file);
+            }
+        }
+        colstore->num_rows += group->num_rows;
+    }
+    return true;
+}
+
+void close_colstore(Colstore *colstore) {
+    fclose(colstore->file_ptr);
+    delete colstore->row_groups;
+}
+
+/**
+ * Whether a page of a sorted column comes before every value in range:
+ * before start or, with past_end, not after end.
+ */
+static bool page_before(ColumnPageInfo *info, const char *bound, int len, bool past_end) {
+    if (past_end) {
+        return memcmp(info->min, bound, len) <= 0;
+    }
+    return memcmp(info->max, bound, len) < 0;
+}
+
+/**
+ * Row of the first page, in row order, for which page_before is false.
+ * Pages of a sorted column are searched a row group at a time, then
+ * within the row group.
+ */
+static uint64_t sorted_partition_row(Colstore *colstore, int attr, const char *bound, int len, bool past_end) {
+    vector<RowGroup> *groups = colstore->row_groups;
+    int lo = 0;
+    int hi = groups->size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (page_before(&groups->at(mid).chunks[attr].back(), bound, len, past_end)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == groups->size()) {
+        return colstore->num_rows;
+    }
+
+    vector<ColumnPageInfo> *chunk = &groups->at(lo).chunks[attr];
+    int first = 0;
+    int last = chunk->size();
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if (page_before(&chunk->at(mid), bound, len, past_end)) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    // Every page of a chunk but the last is full.
+    return groups->at(lo).first_row + (uint64_t) first * (colstore->page_size / ATTRIBUTE_SIZE);
+}
+
+bool colstore_sorted_rows(Colstore *colstore, int attr, const char *start, const char *end, int len,
+                          uint64_t *first_row, uint64_t *last_row) {
+    if (colstore->sort_attr != attr) {
+        return false;
+    }
+    *first_row = sorted_partition_row(colstore, attr, start, len, false);
+    *last_row = max(*first_row, sorted_partition_row(colstore, attr, end, len, true));
+    return true;
+}
+
+/*
+ * Column page encodings.
+ */
+#define PACKED_CHAR_BITS 5
+#define PACKED_VALUE_BITS (PACKED_CHAR_BITS * ATTRIBUTE_SIZE)
+#define PACKING_SLACK 8 // packed data is read 8 bytes at a time
+static_assert(PACKED_VALUE_BITS + 7 <= 64, "a packed value must fit one unaligned 64-bit load");
+
+static inline uint64_t load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint16_t load16(const char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * Store v (bits wide) as the i-th packed field of out, which starts zeroed.
+ */
+static inline void pack_field(char *out, long i, int bits, uint64_t v) {
+    long pos = i * bits;
+    uint64_t word = load64(out + pos / 8) | (v << (pos % 8));
+    memcpy(out + pos / 8, &word, sizeof(word));
+}
+
+static inline uint64_t unpack_field(const char *in, long i, int bits) {
+    long pos = i * bits;
+    return (load64(in + pos / 8) >> (pos % 8)) & (((uint64_t) 1 << bits) - 1);
+}
+
+static inline int packed_bytes(long count, int bits) {
+    return (count * bits + 7) / 8 + PACKING_SLACK;
+}
+
+/**
+ * 5-bit code of a character: NUL is 0 and 'a'-'z' are 1-26, so codes
+ * compare like the characters. Returns -1 for any other character.
+ */
+static inline int char_code(char c) {
+    if (c == '\0') {
+        return 0;
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 1;
+    }
+    return -1;
+}
+
+/**
+ * Pack the first len characters of value, most significant first.
+ * Returns false if a character has no code.
+ */
+static bool pack_prefix(const char *value, int len, uint64_t *key) {
+    *key = 0;
+    for (int i = 0; i < len; i++) {
+        int code = char_code(value[i]);
+        if (code == -1) {
+            return false;
+        }
+        *key = (*key << PACKED_CHAR_BITS) | code;
+    }
+    return true;
+}
+
+static void unpack_value(uint64_t key, char *value) {
+    for (int i = ATTRIBUTE_SIZE - 1; i >= 0; i--) {
+        int code = key & ((1 << PACKED_CHAR_BITS) - 1);
+        value[i] = code == 0 ? '\0' : 'a' + code - 1;
+        key >>= PACKED_CHAR_BITS;
+    }
+}
+
+static void set_bit_range(uint64_t *bits, int from, int to) {
+    for (int i = from; i < to; i++) {
+        bits[i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+}
+
+int column_page_buffer_size(int page_size) {
+    return 1 + (page_size / ATTRIBUTE_SIZE) * ATTRIBUTE_SIZE + PACKING_SLACK;
+}
+
+static int compare_values(const char *a, const char *b) {
+    return memcmp(a, b, ATTRIBUTE_SIZE);
+}
+
+struct ValueOrder {
+    const char *values;
+    bool operator()(int a, int b) const {
+        return compare_values(values + a * ATTRIBUTE_SIZE, values + b * ATTRIBUTE_SIZE) < 0;
+    }
+};
+
+int encode_column_page(const char *values, int count, char *out) {
+    // Size of every encoding that applies, then write the smallest.
+    int sizes[NUM_ENCODINGS];
+    sizes[ENCODING_PLAIN] = 1 + count * ATTRIBUTE_SIZE;
+
+    int runs = count > 0 ? 1 : 0;
+    for (int i = 1; i < count; i++) {
+        if (compare_values(values + (i - 1) * ATTRIBUTE_SIZE, values + i * ATTRIBUTE_SIZE) != 0) {
+            runs++;
+        }
+    }
+    sizes[ENCODING_RLE] = 1 + 4 + runs * (ATTRIBUTE_SIZE + 4);
+
+    sizes[ENCODING_PACKED] = 1 + packed_bytes(count, PACKED_VALUE_BITS);
+    vector<uint64_t> keys(count);
+    for (int i = 0; i < count; i++) {
+        if (!pack_prefix(values + i * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE, &keys[i])) {
+            sizes[ENCODING_PACKED] = INT32_MAX;
+            break;
+        }
+    }
+
+    // Distinct values through a hash table, giving up once a dictionary
+    // could no longer beat PACKED (about 6 bytes a value) or PLAIN.
+    int max_entries = (sizes[ENCODING_PACKED] != INT32_MAX ? count * 2 / 5 : count * 3 / 4) + 1;
+    int table_size = 1;
+    while (table_size < 2 * count) {
+        table_size *= 2;
+    }
+    vector<int> table(table_size, -1);
+    vector<uint32_t> codes(count);
+    vector<int> dict; // index of the first value of each distinct value
+    for (int i = 0; i < count && dict.size() <= max_entries; i++) {
+        const char *value = values + i * ATTRIBUTE_SIZE;
+        uint64_t hash = (load64(value) ^ ((uint64_t) load16(value + 8) << 48)) * 0x9e3779b97f4a7c15ULL;
+        int slot = hash >> 40 & (table_size - 1);
+        while (table[slot] != -1 && compare_values(values + dict[table[slot]] * ATTRIBUTE_SIZE, value) != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == -1) {
+            table[slot] = dict.size();
+            dict.push_back(i);
+        }
+        codes[i] = table[slot];
+    }
+
+    sizes[ENCODING_DICT] = INT32_MAX;
+    if (dict.size() <= max_entries) {
+        // Sort the dictionary so codes compare like the values.
+        vector<int> order(dict.size());
+        for (int d = 0; d < dict.size(); d++) {
+            order[d] = dict[d];
+        }
+        ValueOrder by_value = {values};
+        sort(order.begin(), order.end(), by_value);
+        vector<uint32_t> rank(dict.size());
+        for (int d = 0; d < order.size(); d++) {
+            rank[codes[order[d]]] = d;
+        }
+        for (int i = 0; i < count; i++) {
+            codes[i] = rank[codes[i]];
+        }
+        dict.swap(order);
+    }
+    int code_bits = 1;
+    while (((size_t) 1 << code_bits) < dict.size()) {
+        code_bits++;
+    }
+    if (dict.size() <= max_entries) {
+        sizes[ENCODING_DICT] = 1 + 4 + 1 + dict.size() * ATTRIBUTE_SIZE + packed_bytes(count, code_bits);
+    }
+
+    int encoding = ENCODING_PLAIN;
+    for (int e = 0; e < NUM_ENCODINGS; e++) {
+        if (sizes[e] < sizes[encoding]) {
+            encoding = e;
+        }
+    }
+
+    out[0] = encoding;
+    char *p = out + 1;
+    if (encoding == ENCODING_PLAIN) {
+        memcpy(p, values, count * ATTRIBUTE_SIZE);
+    } else if (encoding == ENCODING_RLE) {
+        memcpy(p, &runs, 4);
+        char *run_values = p + 4;
+        char *run_ends = run_values + runs * ATTRIBUTE_SIZE;
+        int run = 0;
+        for (int i = 1; i <= count; i++) {
+            if (i == count || compare_values(values + (i - 1) * ATTRIBUTE_SIZE, values + i * ATTRIBUTE_SIZE) != 0) {
+                uint32_t end = i;
+                memcpy(run_values + run * ATTRIBUTE_SIZE, values + (i - 1) * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE);
+                memcpy(run_ends + run * 4, &end, 4);
+                run++;
+            }
+        }
+    } else if (encoding == ENCODING_DICT) {
+        uint32_t num_entries = dict.size();
+        memcpy(p, &num_entries, 4);
+        p[4] = code_bits;
+        char *entries = p + 5;
+        for (int d = 0; d < num_entries; d++) {
+            memcpy(entries + d * ATTRIBUTE_SIZE, values + dict[d] * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE);
+        }
+        char *packed = entries + num_entries * ATTRIBUTE_SIZE;
+        memset(packed, 0, packed_bytes(count, code_bits));
+        for (int i = 0; i < count; i++) {
+            pack_field(packed, i, code_bits, codes[i]);
+        }
+    } else {
+        memset(p, 0, packed_bytes(count, PACKED_VALUE_BITS));
+        for (int i = 0; i < count; i++) {
+            pack_field(p, i, PACKED_VALUE_BITS, keys[i]);
+        }
+    }
+    return sizes[encoding];
+}
+
+bool read_column_page(Colstore *colstore, ColumnPageInfo *info, char *buf, EncodedPage *page) {
+    if (pread(fileno(colstore->file_ptr), buf, info->size, info->offset) != (ssize_t) info->size) {
+        fputs("Read error\n", stderr);
+        return false;
+    }
+    return parse_column_page(buf, info->size, info->num_values, page);
+}
+
+bool parse_column_page(const char *buf, uint32_t size, uint32_t num_values, EncodedPage *page) {
+    page->encoding = buf[0];
+    page->num_values = num_values;
+    page->num_entries = 0;
+    page->values = NULL;
+    page->run_ends = NULL;
+    page->packed = NULL;
+    page->bits = 0;
+
+    const char *p = buf + 1;
+    switch (page->encoding) {
+    case ENCODING_PLAIN:
+        page->values = p;
+        return true;
+    case ENCODING_RLE:
+        page->num_entries = load32(p);
+        page->values = p + 4;
+        page->run_ends = page->values + page->num_entries * ATTRIBUTE_SIZE;
+        return true;
+    case ENCODING_DICT:
+        page->num_entries = load32(p);
+        page->bits = p[4];
+        page->values = p + 5;
+        page->packed = page->values + page->num_entries * ATTRIBUTE_SIZE;
+        return true;
+    case ENCODING_PACKED:
+        page->bits = PACKED_VALUE_BITS;
+        page->packed = p;
+        return true;
+    }
+    fprintf(stderr, "Unknown column page encoding %d\n", page->encoding);
+    return false;
+}
+
+void column_page_match(EncodedPage *page, const char *start, const char *end, int len, uint64_t *match) {
+    int count = page->num_values;
+    uint64_t lo, hi;
+    if (page->encoding == ENCODING_PLAIN) {
+        range_match(page->values, count, start, end, len, match);
+    } else if (page->encoding == ENCODING_PACKED && pack_prefix(start, len, &lo) && pack_prefix(end, len, &hi)) {
+        // Packed values keep the order, so compare the packed prefixes.
+        memset(match, 0, slot_bitmap_words(count) * sizeof(uint64_t));
+        int shift = PACKED_CHAR_BITS * (ATTRIBUTE_SIZE - len);
+        for (int i = 0; i < count; i++) {
+            uint64_t prefix = unpack_field(page->packed, i, PACKED_VALUE_BITS) >> shift;
+            match[i / 64] |= (uint64_t) (prefix >= lo && prefix <= hi) << (i % 64);
+        }
+    } else if (page->encoding == ENCODING_DICT || page->encoding == ENCODING_RLE) {
+        // Evaluate the dictionary or the runs once, then expand.
+        vector<uint64_t> entry_match(slot_bitmap_words(page->num_entries) + 1);
+        range_match(page->values, page->num_entries, start, end, len, &entry_match[0]);
+        memset(match, 0, slot_bitmap_words(count) * sizeof(uint64_t));
+        if (page->encoding == ENCODING_DICT) {
+            for (int i = 0; i < count; i++) {
+                uint64_t code = unpack_field(page->packed, i, page->bits);
+                match[i / 64] |= ((entry_match[code / 64] >> (code % 64)) & 1) << (i % 64);
+            }
+        } else {
+            int from = 0;
+            for (int r = 0; r < page->num_entries; r++) {
+                int to = load32(page->run_ends + r * 4);
+                if ((entry_match[r / 64] >> (r % 64)) & 1) {
+                    set_bit_range(match, from, to);
+                }
+                from = to;
+            }
+        }
+    } else {
+        // Bounds outside the packed alphabet: decode and compare.
+        vector<char> values(count * ATTRIBUTE_SIZE);
+        for (int i = 0; i < count; i++) {
+            column_page_value(page, i, &values[i * ATTRIBUTE_SIZE]);
+        }
+        range_match(&values[0], count, start, end, len, match);
+    }
+}
+
+void column_page_value(EncodedPage *page, int i, char *value) {
+    switch (page->encoding) {
+    case ENCODING_PLAIN:
+        memcpy(value, page->values + i * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE);
+        break;
+    case ENCODING_DICT:
+        memcpy(value, page->values + unpack_field(page->packed, i, page->bits) * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE);
+        break;
+    case ENCODING_RLE: {
+        // First run ending after row i.
+        int lo = 0, hi = page->num_entries - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (load32(page->run_ends + mid * 4) > (uint32_t) i) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        memcpy(value, page->values + lo * ATTRIBUTE_SIZE, ATTRIBUTE_SIZE);
+        break;
+    }
+    case ENCODING_PACKED:
+        unpack_value(unpack_field(page->packed, i, PACKED_VALUE_BITS), value);
+        break;
+    }
+}
+
+void bulk_append(BulkLoader *loader, const void *ptr, size_t size) {
+    if (loader->used + size > loader->buf_size) {
+        bulk_flush(loader);
+    }
+    if (size > loader->buf_size) {
+        fwrite_with_check(ptr, size, 1, loader->heapfile->file_ptr);
+        return;
+    }
+    memcpy(loader->buf + loader->used, ptr, size);
+    loader->used += size;
+}
+
+void bulk_flush(BulkLoader *loader) {
+    if (loader->used > 0) {
+        fwrite_with_check(loader->buf, loader->used, 1, loader->heapfile->file_ptr);
+        loader->used = 0;
+    }
+}
+
+bool column_page_may_match(ColumnPageInfo *info, const char *start, const char *end, int len) {
+    return memcmp(start, info->max, len) <= 0 && memcmp(end, info->min, len) >= 0;
+}
+
+/*
+ * Bitmaps. A container covers 65536 rows; BITSET_WORDS words of bits hold
+ * any of its sets, so every operation decodes containers into words and
+ * encodes the result back into the smallest type.
+ */
+#define BITSET_WORDS 1024
+#define BITMAP_MAGIC 0x504d5442 // "BTMP"
+
+static void or_container_words(const BitmapContainer *container, uint64_t *words) {
+    const vector<uint16_t> &data = container->data;
+    if (container->type == CONTAINER_BITSET) {
+        const uint64_t *bits = (const uint64_t *) &data[0];
+        for (int w = 0; w < BITSET_WORDS; w++) {
+            words[w] |= bits[w];
+        }
+    } else if (container->type == CONTAINER_ARRAY) {
+        for (int i = 0; i < data.size(); i++) {
+            words[data[i] / 64] |= 1ULL << (data[i] % 64);
+        }
+    } else {
+        for (int i = 0; i < data.size(); i += 2) {
+            set_bit_range(words, data[i], data[i] + data[i + 1] + 1);
+        }
+    }
+}
+
+static void container_words(const BitmapContainer *container, uint64_t *words) {
+    memset(words, 0, BITSET_WORDS * sizeof(uint64_t));
+    or_container_words(container, words);
+}
+
+/**
+ * Append the container of key holding the bits of words to bitmap, unless
+ * it is empty.
+ */
+static void add_container(uint16_t key, const uint64_t *words, Bitmap *bitmap) {
+    long count = 0;
+    long runs = 0;
+    uint64_t carry = 0; // top bit of the previous word
+    for (int w = 0; w < BITSET_WORDS; w++) {
+        count += __builtin_popcountll(words[w]);
+        runs += __builtin_popcountll(words[w] & ~((words[w] << 1) | carry));
+        carry = words[w] >> 63;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    bitmap->push_back(BitmapContainer());
+    BitmapContainer *container = &bitmap->back();
+    container->key = key;
+    if (count <= 2 * runs && count < BITSET_WORDS * 4) {
+        container->type = CONTAINER_ARRAY;
+        container->data.reserve(count);
+        for (int w = 0; w < BITSET_WORDS; w++) {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                container->data.push_back(w * 64 + __builtin_ctzll(bits));
+            }
+        }
+    } else if (2 * runs < BITSET_WORDS * 4) {
+        // A run starts at a set bit after a clear one and ends at a set
+        // bit before a clear one; the two alternate.
+        container->type = CONTAINER_RUNS;
+        container->data.reserve(2 * runs);
+        carry = 0;
+        int first = 0;
+        for (int w = 0; w < BITSET_WORDS; w++) {
+            uint64_t next = (w + 1 < BITSET_WORDS) ? (words[w + 1] & 1) : 0;
+            uint64_t starts = words[w] & ~((words[w] << 1) | carry);
+            uint64_t ends = words[w] & ~((words[w] >> 1) | (next << 63));
+            carry = words[w] >> 63;
+            while (starts != 0 || ends != 0) {
+                int start = (starts != 0) ? __builtin_ctzll(starts) : 64;
+                int end = (ends != 0) ? __builtin_ctzll(ends) : 64;
+                if (start <= end) {
+                    first = w * 64 + start;
+                    container->data.push_back(first);
+                    starts &= starts - 1;
+                } else {
+                    container->data.push_back(w * 64 + end - first);
+                    ends &= ends - 1;
+                }
+            }
+        }
+    } else {
+        container->type = CONTAINER_BITSET;
+        container->data.resize(BITSET_WORDS * 4);
+        memcpy(&container->data[0], words, BITSET_WORDS * sizeof(uint64_t));
+    }
+}
+
+void bitmap_from_rows(const uint32_t *rows, long count, Bitmap *bitmap) {
+    bitmap->clear();
+    vector<uint64_t> words(BITSET_WORDS);
+    long i = 0;
+    while (i < count) {
+        uint16_t key = rows[i] >> 16;
+        memset(&words[0], 0, BITSET_WORDS * sizeof(uint64_t));
+        for (; i < count && (rows[i] >> 16) == key; i++) {
+            words[(rows[i] & 0xFFFF) / 64] |= 1ULL << (rows[i] % 64);
+        }
+        add_container(key, &words[0], bitmap);
+    }
+}
+
+void bitmap_rows(const Bitmap *bitmap, vector<uint32_t> *rows) {
+    rows->clear();
+    vector<uint64_t> words(BITSET_WORDS);
+    for (int c = 0; c < bitmap->size(); c++) {
+        const BitmapContainer *container = &bitmap->at(c);
+        uint32_t high = (uint32_t) container->key << 16;
+        if (container->type == CONTAINER_ARRAY) {
+            for (int i = 0; i < container->data.size(); i++) {
+                rows->push_back(high | container->data[i]);
+            }
+            continue;
+        }
+        container_words(container, &words[0]);
+        for (int w = 0; w < BITSET_WORDS; w++) {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                rows->push_back(high | (w * 64 + __builtin_ctzll(bits)));
+            }
+        }
+    }
+}
+
+uint64_t bitmap_cardinality(const Bitmap *bitmap) {
+    uint64_t count = 0;
+    for (int c = 0; c < bitmap->size(); c++) {
+        const BitmapContainer *container = &bitmap->at(c);
+        if (container->type == CONTAINER_ARRAY) {
+            count += container->data.size();
+        } else if (container->type == CONTAINER_RUNS) {
+            for (int i = 1; i < container->data.size(); i += 2) {
+                count += container->data[i] + 1;
+            }
+        } else {
+            const uint64_t *words = (const uint64_t *) &container->data[0];
+            for (int w = 0; w < BITSET_WORDS; w++) {
+                count += __builtin_popcountll(words[w]);
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Intersect or unite a and b container by container. out may be a or b.
+ */
+static void merge_bitmaps(const Bitmap *a, const Bitmap *b, bool intersect, Bitmap *out) {
+    Bitmap result;
+    vector<uint64_t> words(BITSET_WORDS);
+    vector<uint64_t> other(BITSET_WORDS);
+    int i = 0;
+    int j = 0;
+    while (i < a->size() || j < b->size()) {
+        if (j == b->size() || (i < a->size() && a->at(i).key < b->at(j).key)) {
+            if (!intersect) {
+                result.push_back(a->at(i));
+            }
+            i++;
+        } else if (i == a->size() || b->at(j).key < a->at(i).key) {
+            if (!intersect) {
+                result.push_back(b->at(j));
+            }
+            j++;
+        } else {
+            container_words(&a->at(i), &words[0]);
+            container_words(&b->at(j), &other[0]);
+            for (int w = 0; w < BITSET_WORDS; w++) {
+                words[w] = intersect ? (words[w] & other[w]) : (words[w] | other[w]);
+            }
+            add_container(a->at(i).key, &words[0], &result);
+            i++;
+            j++;
+        }
+    }
+    out->swap(result);
+}
+
+void bitmap_and(const Bitmap *a, const Bitmap *b, Bitmap *out) {
+    merge_bitmaps(a, b, true, out);
+}
+
+void bitmap_or(const Bitmap *a, const Bitmap *b, Bitmap *out) {
+    merge_bitmaps(a, b, false, out);
+}
+
+string bitmap_index_path(const char *colstore_name, int attr_id) {
+    return string(colstore_name) + "." + to_string(attr_id) + BITMAP_INDEX_SUFFIX;
+}
+
+bool build_bitmap_index(BitmapIndex *index, Colstore *colstore, int attr_id, int prefix_len) {
+    if (colstore->num_rows > UINT32_MAX) {
+        return false;
+    }
+    // Rows are visited in order, so each list stays sorted.
+    map<string, vector<uint32_t> > rows;
+    char *buf = (char *) malloc(column_page_buffer_size(colstore->page_size));
+    EncodedPage page;
+    char value[ATTRIBUTE_SIZE];
+    uint32_t row = 0;
+    for (int g = 0; g < colstore->row_groups->size(); g++) {
+        vector<ColumnPageInfo> *chunk = &colstore->row_groups->at(g).chunks[attr_id];
+        for (int p = 0; p < chunk->size(); p++) {
+            if (!read_column_page(colstore, &chunk->at(p), buf, &page)) {
+                free(buf);
+                return false;
+            }
+            for (int i = 0; i < page.num_values; i++) {
+                column_page_value(&page, i, value);
+                rows[string(value, prefix_len)].push_back(row++);
+            }
+        }
+    }
+    free(buf);
+
+    index->attr_id = attr_id;
+    index->prefix_len = prefix_len;
+    index->num_rows = colstore->num_rows;
+    index->prefixes = new vector<string>;
+    index->bitmaps = new vector<Bitmap>(rows.size());
+    int k = 0;
+    for (map<string, vector<uint32_t> >::iterator it = rows.begin(); it != rows.end(); ++it, k++) {
+        index->prefixes->push_back(it->first);
+        bitmap_from_rows(&it->second[0], it->second.size(), &index->bitmaps->at(k));
+    }
+    return true;
+}
+
+void write_bitmap_index(BitmapIndex *index, FILE *file) {
+    uint32_t header[4] = {BITMAP_MAGIC, (uint32_t) index->attr_id, (uint32_t) index->prefix_len,
+                          (uint32_t) index->prefixes->size()};
+    fwrite_with_check(header, sizeof(header), 1, file);
+    fwrite_with_check(&index->num_rows, sizeof(uint64_t), 1, file);
+    for (int k = 0; k < index->prefixes->size(); k++) {
+        Bitmap *bitmap = &index->bitmaps->at(k);
+        uint32_t num_containers = bitmap->size();
+        fwrite_with_check(index->prefixes->at(k).data(), index->prefix_len, 1, file);
+        fwrite_with_check(&num_containers, sizeof(uint32_t), 1, file);
+        for (int c = 0; c < num_containers; c++) {
+            BitmapContainer *container = &bitmap->at(c);
+            uint32_t size = container->data.size();
+            fwrite_with_check(&container->key, sizeof(uint16_t), 1, file);
+            fwrite_with_check(&container->type, sizeof(uint16_t), 1, file);
+            fwrite_with_check(&size, sizeof(uint32_t), 1, file);
+            fwrite_with_check(&container->data[0], size * sizeof(uint16_t), 1, file);
+        }
+    }
+}
+
+bool read_bitmap_index(BitmapIndex *index, FILE *file) {
+    uint32_t header[4];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != BITMAP_MAGIC
+        || header[2] < 1 || header[2] > BITMAP_MAX_PREFIX) {
+        return false;
+    }
+    index->attr_id = header[1];
+    index->prefix_len = header[2];
+    fread_with_check(&index->num_rows, sizeof(uint64_t), 1, file);
+    index->prefixes = new vector<string>(header[3]);
+    index->bitmaps = new vector<Bitmap>(header[3]);
+    char prefix[BITMAP_MAX_PREFIX];
+    for (int k = 0; k < header[3]; k++) {
+        Bitmap *bitmap = &index->bitmaps->at(k);
+        uint32_t num_containers;
+        fread_with_check(prefix, index->prefix_len, 1, file);
+        fread_with_check(&num_containers, sizeof(uint32_t), 1, file);
+        index->prefixes->at(k).assign(prefix, index->prefix_len);
+        bitmap->resize(num_containers);
+        for (int c = 0; c < num_containers; c++) {
+            BitmapContainer *container = &bitmap->at(c);
+            uint32_t size;
+            fread_with_check(&container->key, sizeof(uint16_t), 1, file);
+            fread_with_check(&container->type, sizeof(uint16_t), 1, file);
+            fread_with_check(&size, sizeof(uint32_t), 1, file);
+            container->data.resize(size);
+            fread_with_check(&container->data[0], size * sizeof(uint16_t), 1, file);
+        }
+    }
+    return true;
+}
+
+void free_bitmap_index(BitmapIndex *index) {
+    delete index->prefixes;
+    delete index->bitmaps;
+}
+
+void remove_bitmap_indexes(const char *colstore_name) {
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        remove(bitmap_index_path(colstore_name, attr).c_str());
+    }
+}
+
+bool bitmap_index_range(BitmapIndex *index, const char *start, const char *end, int len, Bitmap *rows) {
+    // Beyond the prefix, only the prefix of the bounds can be compared.
+    int n = min(len, index->prefix_len);
+
+    // Many prefixes may be in range: OR them all into one bit per row,
+    // then compress once.
+    int num_keys = (index->num_rows >> 16) + 1;
+    vector<uint64_t> words((size_t) num_keys * BITSET_WORDS);
+    for (int k = 0; k < index->prefixes->size(); k++) {
+        const char *prefix = index->prefixes->at(k).data();
+        if (memcmp(prefix, start, n) < 0 || memcmp(prefix, end, n) > 0) {
+            continue;
+        }
+        Bitmap *bitmap = &index->bitmaps->at(k);
+        for (int c = 0; c < bitmap->size(); c++) {
+            or_container_words(&bitmap->at(c), &words[(size_t) bitmap->at(c).key * BITSET_WORDS]);
+        }
+    }
+    rows->clear();
+    for (int key = 0; key < num_keys; key++) {
+        add_container(key, &words[(size_t) key * BITSET_WORDS], rows);
+    }
+    return len <= index->prefix_len;
+}
+
+/**
+ * Find a page with at least one free slot using the free space map.
+ * The fullest page with room is returned so that holes are filled first.
+ */
+PageID find_free_page(Heapfile *heapfile) {
+    FreeSpaceMap *fsm = heapfile->free_space_map;
+    for (int b = 0; b < FSM_BUCKETS; b++) {
+        if (!fsm->buckets[b].empty()) {
+            return fsm->buckets[b].back();
+        }
+    }
+    return -1;
+}
+
+/**
+ * Record the free space of page pid, free_slots * slot_size bytes, in its
+ * directory entry and in the free space map.
+ */
+void set_page_free_slots(Heapfile *heapfile, PageID pid, int free_slots) {
+    int page_size = heapfile->page_size;
+    int free_space = free_slots * heapfile->slot_size;
+    if (heapfile->free_space_map->free_space.at(pid - 1) == free_space) {
+        return;
+    }
+    fsm_update(heapfile, pid, free_space);
+
+    int number_of_pages_per_dir = get_number_of_pages(page_size);
+    int nth_dir = (pid - 1) / number_of_pages_per_dir;
+    int order_in_dir = (pid - 1) % number_of_pages_per_dir;
+    FILE *file = heapfile->file_ptr;
+
+    fseek(file, heapfile->dir_offsets->at(nth_dir) + sizeof(Page) + 2 * OFFSET_SIZE + order_in_dir * get_entry_size(page_size), SEEK_SET);
+    fwrite_with_check(&free_space, get_free_space_size(page_size), 1, file);
+}
+
+/**
+ * Move page pid to the free space map bucket matching free_space bytes.
+ */
+void fsm_update(Heapfile *heapfile, PageID pid, int free_space) {
+    FreeSpaceMap *fsm = heapfile->free_space_map;
+    int index = pid - 1;
+    if (index >= fsm->free_space.size()) {
+        fsm->free_space.resize(index + 1, 0);
+        fsm->bucket_of.resize(index + 1, -1);
+        fsm->position.resize(index + 1, -1);
+    }
+
+    // Unlink from the old bucket by moving its last page into the hole.
+    int old_bucket = fsm->bucket_of[index];
+    if (old_bucket != -1) {
+        vector<PageID> *bucket = &fsm->buckets[old_bucket];
+        PageID moved = bucket->back();
+        bucket->at(fsm->position[index]) = moved;
+        fsm->position[moved - 1] = fsm->position[index];
+        bucket->pop_back();
+    }
+
+    fsm->free_space[index] = free_space;
+    fsm->bucket_of[index] = -1;
+    if (free_space > 0) {
+        int b = min(FSM_BUCKETS - 1, (int) ((long) free_space * FSM_BUCKETS / heapfile->page_size));
+        fsm->bucket_of[index] = b;
+        fsm->position[index] = fsm->buckets[b].size();
+        fsm->buckets[b].push_back(pid);
+    }
+}
+
+/**
+ * Read a page into memory
+ */
+void read_page(Heapfile *heapfile, PageID pid, Page *page) {
+    Page *frame = pin_page(heapfile, pid);
+    if (frame == NULL) {
+        page->data = NULL;
+        return;
+    }
+    page->page_size = frame->page_size;
+    page->slot_size = frame->slot_size;
+    page->data = malloc(heapfile->page_size);
+    memcpy(page->data, frame->data, heapfile->page_size);
+    page->slot_bitmap = (uint64_t *) malloc(slot_bitmap_words(fixed_len_page_capacity(frame)) * sizeof(uint64_t));
+    memcpy(page->slot_bitmap, frame->slot_bitmap, slot_bitmap_words(fixed_len_page_capacity(frame)) * sizeof(uint64_t));
+
+    unpin_page(heapfile, pid, false);
+}
+
+/**
+ * Write a page from memory to disk
+ */
+void write_page(Page *page, Heapfile *heapfile, PageID pid) {
+    int num_words = slot_bitmap_words(fixed_len_page_capacity(page));
+    Page *frame = fetch_frame(heapfile, pid, false, num_words);
+    if (frame == NULL) {
+        page->data = NULL;
+        return;
+    }
+    frame->page_size = page->page_size;
+    frame->slot_size = page->slot_size;
+    memcpy(frame->data, page->data, heapfile->page_size);
+    memcpy(frame->slot_bitmap, page->slot_bitmap, num_words * sizeof(uint64_t));
+
+    unpin_page(heapfile, pid, true);
+}
+
+/**
+ * Open an existing heapfile stored in file, reading its header.
+ */
+void open_heapfile(Heapfile *heapfile, int page_size, FILE *file) {
+    fseek(file, 0, SEEK_SET);
+    fread_with_check(heapfile, HEAPFILE_HEADER_SIZE, 1, file);
+    heapfile->file_ptr = file;
+    heapfile->page_size = page_size;
+    heapfile->dir_offsets = new vector<uint32_t>;
+    heapfile->page_offsets = new vector<uint32_t>;
+    heapfile->free_space_map = new FreeSpaceMap;
+    heapfile->zone_map = NULL;
+    heapfile->bloom = NULL;
+    heapfile->indexes = new vector<BTree *>;
+    heapfile->hash_indexes = new vector<HashIndex *>;
+
+    load_directory(heapfile);
+
+    // New pages take the slot size of the existing ones.
+    heapfile->slot_size = SLOT_SIZE;
+    if (reach_page(heapfile, 1) == 0) {
+        Page first_page;
+        fread_with_check(&first_page, sizeof(Page), 1, file);
+        heapfile->slot_size = first_page.slot_size;
+    }
+}
+
+/**
+ * Write back every dirty buffered page of the heapfile and close its file.
+ */
+void close_heapfile(Heapfile *heapfile) {
+    flush_heapfile(heapfile);
+    drop_frames(heapfile);
+
+    fflush(heapfile->file_ptr);
+    fclose(heapfile->file_ptr);
+
+    delete heapfile->dir_offsets;
+    delete heapfile->page_offsets;
+    delete heapfile->free_space_map;
+    if (heapfile->zone_map != NULL) {
+        fclose(heapfile->zone_map->file_ptr);
+        delete heapfile->zone_map->block;
+        delete heapfile->zone_map->attrs;
+        delete heapfile->zone_map;
+    }
+    if (heapfile->bloom != NULL) {
+        fclose(heapfile->bloom->file_ptr);
+        free_bloom_filters(heapfile->bloom);
+        delete heapfile->bloom;
+    }
+    for (int i = 0; i < heapfile->indexes->size(); i++) {
+        close_index(heapfile->indexes->at(i));
+        delete heapfile->indexes->at(i);
+    }
+    delete heapfile->indexes;
+    for (int i = 0; i < heapfile->hash_indexes->size(); i++) {
+        close_hash_index(heapfile->hash_indexes->at(i));
+        delete heapfile->hash_indexes->at(i);
+    }
+    delete heapfile->hash_indexes;
+}
+
+/*
+ * Zone maps. The file starts with ZONE_MAGIC, the number of attributes
+ * with zones and their ids as uint32_t values, in ZONE_HEADER_BYTES.
+ * Zones of page pid are in block (pid - 1) / ZONE_MAP_BLOCK_PAGES; within
+ * a block, the zones of each attribute follow those of the one before it
+ * in the header.
+ */
+#define ZONE_MAGIC 0x454e4f5a // "ZONE"
+#define ZONE_HEADER_BYTES ((off_t) (2 + ATTR_PER_RECORD) * sizeof(uint32_t))
+
+static inline off_t zone_block_bytes(ZoneMap *zone_map) {
+    return (off_t) zone_map->attrs->size() * ZONE_MAP_BLOCK_PAGES * sizeof(Zone);
+}
+
+static inline off_t zone_block_offset(ZoneMap *zone_map, int block_id) {
+    return ZONE_HEADER_BYTES + block_id * zone_block_bytes(zone_map);
+}
+
+typedef struct {
+    uint64_t high; // first 8 bytes, big-endian
+    uint16_t low;  // last 2 bytes, big-endian
+} ValueKey;
+
+static_assert(ATTRIBUTE_SIZE == 10, "ValueKey holds 10-byte values");
+
+static inline ValueKey value_key(const char *value) {
+    uint64_t high;
+    uint16_t low;
+    memcpy(&high, value, sizeof(high));
+    memcpy(&low, value + 8, sizeof(low));
+    ValueKey key = {__builtin_bswap64(high), __builtin_bswap16(low)};
+    return key;
+}
+
+static inline bool key_less(ValueKey a, ValueKey b) {
+    return a.high < b.high || (a.high == b.high && a.low < b.low);
+}
+
+static void set_empty_zone(Zone *zone) {
+    memset(zone->min, 0xff, ATTRIBUTE_SIZE);
+    memset(zone->max, 0, ATTRIBUTE_SIZE);
+}
+
+/**
+ * Make block_id the block held in memory. Zones missing from the file
+ * belong to pages that were never written, which are empty.
+ */
+static void load_zone_block(Heapfile *heapfile, int block_id) {
+    ZoneMap *zone_map = heapfile->zone_map;
+    if (zone_map->block_id == block_id) {
+        return;
+    }
+    flush_zone_map(heapfile);
+
+    for (int i = 0; i < zone_map->block->size(); i++) {
+        set_empty_zone(&zone_map->block->at(i));
+    }
+    if (pread(fileno(zone_map->file_ptr), &zone_map->block->at(0), zone_block_bytes(zone_map),
+              zone_block_offset(zone_map, block_id)) < 0) {
+        fputs("Read error\n", stderr);
+        exit(2);
+    }
+    zone_map->block_id = block_id;
+}
+
+bool open_zone_map(Heapfile *heapfile, const char *heapfile_name, const vector<int> *attrs) {
+    string path = string(heapfile_name) + ZONE_MAP_SUFFIX;
+    if (attrs != NULL && heapfile->number_of_page != 0) {
+        fputs("A zone map can only be created for an empty heapfile\n", stderr);
+        exit(2);
+    }
+    FILE *file = fopen(path.c_str(), (attrs != NULL) ? "wb+" : "rb+");
+    if (file == NULL) {
+        return false;
+    }
+
+    uint32_t header[2 + ATTR_PER_RECORD];
+    memset(header, 0, sizeof(header));
+    if (attrs != NULL) {
+        header[0] = ZONE_MAGIC;
+        for (int i = 0; i < attrs->size(); i++) {
+            if (find(header + 2, header + 2 + header[1], (uint32_t) attrs->at(i)) == header + 2 + header[1]) {
+                header[2 + header[1]++] = attrs->at(i);
+            }
+        }
+        if (pwrite(fileno(file), header, sizeof(header), 0) != sizeof(header)) {
+            fputs("Write error\n", stderr);
+            exit(2);
+        }
+    } else if (pread(fileno(file), header, sizeof(header), 0) != sizeof(header) || header[0] != ZONE_MAGIC
+               || header[1] > ATTR_PER_RECORD) {
+        fprintf(stderr, "%s holds no zone map\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+
+    ZoneMap *zone_map = new ZoneMap;
+    zone_map->file_ptr = file;
+    zone_map->attrs = new vector<int>(header + 2, header + 2 + header[1]);
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        zone_map->column[attr] = -1;
+    }
+    for (int i = 0; i < zone_map->attrs->size(); i++) {
+        zone_map->column[zone_map->attrs->at(i)] = i;
+    }
+    zone_map->block = new vector<Zone>(zone_map->attrs->size() * ZONE_MAP_BLOCK_PAGES);
+    zone_map->block_id = -1;
+    zone_map->dirty = false;
+    heapfile->zone_map = zone_map;
+    return true;
+}
+
+/**
+ * Recompute the zones of page pid, which has just been written.
+ */
+void update_zone_map(Heapfile *heapfile, PageID pid, Page *page) {
+    ZoneMap *zone_map = heapfile->zone_map;
+    if (zone_map == NULL || zone_map->attrs->empty()) {
+        return;
+    }
+    load_zone_block(heapfile, (pid - 1) / ZONE_MAP_BLOCK_PAGES);
+
+    Zone *zones = &zone_map->block->at((pid - 1) % ZONE_MAP_BLOCK_PAGES);
+    int num_zones = zone_map->attrs->size();
+    for (int z = 0; z < num_zones; z++) {
+        set_empty_zone(&zones[z * ZONE_MAP_BLOCK_PAGES]);
+    }
+
+    // Values are compared as big-endian keys, so the order is memcmp's.
+    int num_attrs = min(ATTR_PER_RECORD, page->slot_size / ATTRIBUTE_SIZE);
+    ValueKey lo[ATTR_PER_RECORD];
+    ValueKey hi[ATTR_PER_RECORD];
+    const char *lo_value[ATTR_PER_RECORD];
+    const char *hi_value[ATTR_PER_RECORD];
+    for (int z = 0; z < num_zones; z++) {
+        lo[z].high = UINT64_MAX;
+        lo[z].low = UINT16_MAX;
+        hi[z].high = 0;
+        hi[z].low = 0;
+    }
+    bool empty = true;
+    int capacity = fixed_len_page_capacity(page);
+    for (int slot = 0; slot < capacity; slot++) {
+        if (!slot_is_used(page, slot)) {
+            continue;
+        }
+        const char *record = (const char *) page->data + slot * page->slot_size;
+        for (int z = 0; z < num_zones; z++) {
+            int attr = zone_map->attrs->at(z);
+            if (attr >= num_attrs) {
+                continue;
+            }
+            const char *value = record + attr * ATTRIBUTE_SIZE;
+            ValueKey key = value_key(value);
+            // Ties replace the sentinels the first time around.
+            if (!key_less(lo[z], key)) {
+                lo[z] = key;
+                lo_value[z] = value;
+            }
+            if (!key_less(key, hi[z])) {
+                hi[z] = key;
+                hi_value[z] = value;
+            }
+        }
+        empty = false;
+    }
+    if (!empty) {
+        for (int z = 0; z < num_zones; z++) {
+            if (zone_map->attrs->at(z) < num_attrs) {
+                memcpy(zones[z * ZONE_MAP_BLOCK_PAGES].min, lo_value[z], ATTRIBUTE_SIZE);
+                memcpy(zones[z * ZONE_MAP_BLOCK_PAGES].max, hi_value[z], ATTRIBUTE_SIZE);
+            }
+        }
+    }
+    zone_map->dirty = true;
+}
+
+/**
+ * Write the block held in memory back to the zone map file.
+ */
+void flush_zone_map(Heapfile *heapfile) {
+    ZoneMap *zone_map = heapfile->zone_map;
+    if (zone_map == NULL || !zone_map->dirty) {
+        return;
+    }
+    if (pwrite(fileno(zone_map->file_ptr), &zone_map->block->at(0), zone_block_bytes(zone_map),
+               zone_block_offset(zone_map, zone_map->block_id)) != zone_block_bytes(zone_map)) {
+        fputs("Write error\n", stderr);
+        exit(2);
+    }
+    zone_map->dirty = false;
+}
+
+void zone_map_pages(Heapfile *heapfile, int attr_id, const char *start, const char *end, vector<PageID> *pages) {
+    pages->clear();
+    int num_pages = heapfile->number_of_page;
+    ZoneMap *zone_map = heapfile->zone_map;
+    if (zone_map == NULL || zone_map->column[attr_id] == -1) {
+        for (PageID pid = 1; pid <= num_pages; pid++) {
+            pages->push_back(pid);
+        }
+        return;
+    }
+
+    // Only the zones of attr_id are read from each block.
+    vector<Zone> zones(ZONE_MAP_BLOCK_PAGES);
+    int column = zone_map->column[attr_id];
+    off_t attr_offset = (off_t) column * ZONE_MAP_BLOCK_PAGES * sizeof(Zone);
+    for (int b = 0; b * ZONE_MAP_BLOCK_PAGES < num_pages; b++) {
+        int count = min(ZONE_MAP_BLOCK_PAGES, num_pages - b * ZONE_MAP_BLOCK_PAGES);
+        if (b == zone_map->block_id) {
+            memcpy(&zones[0], &zone_map->block->at(column * ZONE_MAP_BLOCK_PAGES), count * sizeof(Zone));
+        } else {
+            ssize_t size = pread(fileno(zone_map->file_ptr), &zones[0], count * sizeof(Zone),
+                                 zone_block_offset(zone_map, b) + attr_offset);
+            if (size != (ssize_t) (count * sizeof(Zone))) {
+                // Block never written: its pages are empty.
+                continue;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            Zone *zone = &zones[i];
+            if (memcmp(zone->min, zone->max, ATTRIBUTE_SIZE) > 0) {
+                continue;
+            }
+            AttrView min_attr = {zone->min, ATTRIBUTE_SIZE};
+            AttrView max_attr = {zone->max, ATTRIBUTE_SIZE};
+            if (compare_attr(max_attr, start) >= 0 && compare_attr(min_attr, end) <= 0) {
+                pages->push_back(b * ZONE_MAP_BLOCK_PAGES + i + 1);
+            }
+        }
+    }
+}
+
+/*
+ * B+ tree indexes. A node starts with a BTreeNode header. A leaf follows it
+ * with up to LEAF_CAPACITY entries; an inner node with INNER_CAPACITY + 1
+ * child node ids, then INNER_CAPACITY keys. Key i of an inner node is a
+ * lower bound of the entries under child i + 1.
+ */
+#define BTREE_MAGIC 0x45455242 // "BREE"
+
+typedef struct {
+    uint32_t leaf;
+    uint32_t count; // entries of a leaf, keys of an inner node
+    uint32_t next;  // next leaf, 0 after the last one
+} BTreeNode;
+
+#define LEAF_CAPACITY ((int) ((BTREE_NODE_SIZE - sizeof(BTreeNode)) / sizeof(IndexEntry)))
+#define INNER_CAPACITY ((int) ((BTREE_NODE_SIZE - sizeof(BTreeNode) - sizeof(uint32_t)) \
+                               / (sizeof(uint32_t) + sizeof(IndexEntry))))
+
+static inline IndexEntry *leaf_entries(char *node) {
+    return (IndexEntry *) (node + sizeof(BTreeNode));
+}
+
+static inline uint32_t *inner_children(char *node) {
+    return (uint32_t *) (node + sizeof(BTreeNode));
+}
+
+static inline IndexEntry *inner_keys(char *node) {
+    return (IndexEntry *) (node + sizeof(BTreeNode) + (INNER_CAPACITY + 1) * sizeof(uint32_t));
+}
+
+static int compare_entries(const IndexEntry *a, const IndexEntry *b) {
+    int result = memcmp(a->value, b->value, ATTRIBUTE_SIZE);
+    if (result != 0) {
+        return result;
+    }
+    if (a->rid.page_id != b->rid.page_id) {
+        return (a->rid.page_id < b->rid.page_id) ? -1 : 1;
+    }
+    return (a->rid.slot < b->rid.slot) ? -1 : (a->rid.slot > b->rid.slot);
+}
+
+struct EntryOrder {
+    bool operator()(const IndexEntry &a, const IndexEntry &b) const {
+        return compare_entries(&a, &b) < 0;
+    }
+};
+
+static void read_node(BTree *tree, uint32_t id, char *node) {
+    if (pread(fileno(tree->file_ptr), node, BTREE_NODE_SIZE, (off_t) id * BTREE_NODE_SIZE) != BTREE_NODE_SIZE) {
+        fputs("Read error\n", stderr);
+        exit(2);
+    }
+}
+
+static void write_node(BTree *tree, uint32_t id, const char *node) {
+    if (pwrite(fileno(tree->file_ptr), node, BTREE_NODE_SIZE, (off_t) id * BTREE_NODE_SIZE) != BTREE_NODE_SIZE) {
+        fputs("Write error\n", stderr);
+        exit(2);
+    }
+}
+
+static void write_index_header(BTree *tree) {
+    char node[BTREE_NODE_SIZE];
+    memset(node, 0, sizeof(node));
+    uint32_t header[5] = {BTREE_MAGIC, (uint32_t) tree->attr_id, tree->root, tree->num_nodes, tree->height};
+    memcpy(node, header, sizeof(header));
+    memcpy(node + sizeof(header), &tree->num_entries, sizeof(uint64_t));
+    write_node(tree, 0, node);
+}
+
+/**
+ * Position of the first of count sorted entries that is not less than entry.
+ */
+static int lower_bound_entry(const IndexEntry *entries, int count, const IndexEntry *entry) {
+    int lo = 0;
+    int hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (compare_entries(&entries[mid], entry) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Child of an inner node whose subtree holds entry.
+ */
+static int child_for_entry(char *node, const IndexEntry *entry) {
+    IndexEntry *keys = inner_keys(node);
+    int lo = 0;
+    int hi = ((BTreeNode *) node)->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (compare_entries(&keys[mid], entry) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Position of the first of count entries whose value is not less than
+ * start, compared like compare_attr.
+ */
+static int lower_bound_value(const IndexEntry *entries, int count, const char *start) {
+    int lo = 0;
+    int hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        AttrView value = {entries[mid].value, ATTRIBUTE_SIZE};
+        if (compare_attr(value, start) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+string index_path(const char *heapfile_name, int attr_id) {
+    return string(heapfile_name) + "." + to_string(attr_id) + INDEX_SUFFIX;
+}
+
+void build_index(BTree *tree, FILE *file, Heapfile *heapfile, int attr_id) {
+    vector<IndexEntry> entries;
+    RecordIterator *it = new RecordIterator(heapfile);
+    RecordBatch batch;
+    while (it->next_batch(&batch, RECORD_BATCH_SIZE) > 0) {
+        for (int row = 0; row < batch.size; row++) {
+            RecordView record = batch_row(&batch, row);
+            IndexEntry entry;
+            memcpy(entry.value, record_view_attr(&record, attr_id).data, ATTRIBUTE_SIZE);
+            entry.rid.page_id = batch.page_id;
+            entry.rid.slot = batch.slots[row];
+            entries.push_back(entry);
+        }
+    }
+    delete it;
+    sort(entries.begin(), entries.end(), EntryOrder());
+
+    tree->file_ptr = file;
+    tree->attr_id = attr_id;
+    tree->num_nodes = 1;
+    tree->height = 1;
+    tree->num_entries = entries.size();
+
+    // Leaves, left to right, leaving room for later inserts.
+    char node[BTREE_NODE_SIZE];
+    BTreeNode *header = (BTreeNode *) node;
+    int leaf_fill = max(1, LEAF_CAPACITY * BTREE_FILL_PERCENT / 100);
+    int num_leaves = max((size_t) 1, (entries.size() + leaf_fill - 1) / leaf_fill);
+    vector<uint32_t> level;  // nodes of the level being built
+    vector<IndexEntry> lows; // smallest entry under each of them
+    for (int l = 0; l < num_leaves; l++) {
+        int first = l * leaf_fill;
+        int count = min((int) entries.size() - first, leaf_fill);
+        memset(node, 0, sizeof(node));
+        header->leaf = 1;
+        header->count = count;
+        header->next = (l + 1 < num_leaves) ? tree->num_nodes + 1 : 0;
+        if (count > 0) {
+            memcpy(leaf_entries(node), &entries[first], count * sizeof(IndexEntry));
+            lows.push_back(entries[first]);
+        } else {
+            lows.push_back(IndexEntry());
+        }
+        level.push_back(tree->num_nodes);
+        write_node(tree, tree->num_nodes++, node);
+    }
+
+    // Inner levels until a single root is left.
+    int inner_fill = max(1, INNER_CAPACITY * BTREE_FILL_PERCENT / 100);
+    while (level.size() > 1) {
+        vector<uint32_t> parents;
+        vector<IndexEntry> parent_lows;
+        for (int first = 0; first < level.size(); first += inner_fill + 1) {
+            int count = min((int) level.size() - first, inner_fill + 1);
+            memset(node, 0, sizeof(node));
+            header->leaf = 0;
+            header->count = count - 1;
+            for (int c = 0; c < count; c++) {
+                inner_children(node)[c] = level[first + c];
+                if (c > 0) {
+                    inner_keys(node)[c - 1] = lows[first + c];
+                }
+            }
+            parents.push_back(tree->num_nodes);
+            parent_lows.push_back(lows[first]);
+            write_node(tree, tree->num_nodes++, node);
+        }
+        level.swap(parents);
+        lows.swap(parent_lows);
+        tree->height++;
+    }
+    tree->root = level[0];
+    write_index_header(tree);
+}
+
+bool open_index(BTree *tree, FILE *file) {
+    char node[BTREE_NODE_SIZE];
+    uint32_t header[5];
+    if (pread(fileno(file), node, BTREE_NODE_SIZE, 0) != BTREE_NODE_SIZE) {
+        return false;
+    }
+    memcpy(header, node, sizeof(header));
+    if (header[0] != BTREE_MAGIC) {
+        return false;
+    }
+    tree->file_ptr = file;
+    tree->attr_id = header[1];
+    tree->root = header[2];
+    tree->num_nodes = header[3];
+    tree->height = header[4];
+    memcpy(&tree->num_entries, node + sizeof(header), sizeof(uint64_t));
+    return true;
+}
+
+void close_index(BTree *tree) {
+    write_index_header(tree);
+    fclose(tree->file_ptr);
+}
+
+/**
+ * Insert entry into the subtree of node id. Returns true if the node was
+ * split; split_key and split_node then give the new right sibling that
+ * the parent has to link.
+ */
+static bool insert_entry(BTree *tree, uint32_t id, const IndexEntry *entry,
+                         IndexEntry *split_key, uint32_t *split_node) {
+    char node[BTREE_NODE_SIZE];
+    read_node(tree, id, node);
+    BTreeNode *header = (BTreeNode *) node;
+
+    if (header->leaf) {
+        IndexEntry *entries = leaf_entries(node);
+        int pos = lower_bound_entry(entries, header->count, entry);
+        if (header->count < LEAF_CAPACITY) {
+            memmove(&entries[pos + 1], &entries[pos], (header->count - pos) * sizeof(IndexEntry));
+            entries[pos] = *entry;
+            header->count++;
+            write_node(tree, id, node);
+            return false;
+        }
+
+        // Split the full leaf in half; the right half goes to a new node.
+        vector<IndexEntry> all(entries, entries + header->count);
+        all.insert(all.begin() + pos, *entry);
+        int left = all.size() / 2;
+        char right[BTREE_NODE_SIZE];
+        memset(right, 0, sizeof(right));
+        BTreeNode *right_header = (BTreeNode *) right;
+        right_header->leaf = 1;
+        right_header->count = all.size() - left;
+        right_header->next = header->next;
+        memcpy(leaf_entries(right), &all[left], right_header->count * sizeof(IndexEntry));
+
+        *split_node = tree->num_nodes++;
+        header->count = left;
+        header->next = *split_node;
+        memcpy(entries, &all[0], left * sizeof(IndexEntry));
+        write_node(tree, *split_node, right);
+        write_node(tree, id, node);
+        *split_key = all[left];
+        return true;
+    }
+
+    int child = child_for_entry(node, entry);
+    IndexEntry key;
+    uint32_t new_child;
+    if (!insert_entry(tree, inner_children(node)[child], entry, &key, &new_child)) {
+        return false;
+    }
+
+    IndexEntry *keys = inner_keys(node);
+    uint32_t *children = inner_children(node);
+    if (header->count < INNER_CAPACITY) {
+        memmove(&keys[child + 1], &keys[child], (header->count - child) * sizeof(IndexEntry));
+        memmove(&children[child + 2], &children[child + 1], (header->count - child) * sizeof(uint32_t));
+        keys[child] = key;
+        children[child + 1] = new_child;
+        header->count++;
+        write_node(tree, id, node);
+        return false;
+    }
+
+    // Split the full inner node; its middle key moves up to the parent.
+    vector<IndexEntry> all_keys(keys, keys + header->count);
+    vector<uint32_t> all_children(children, children + header->count + 1);
+    all_keys.insert(all_keys.begin() + child, key);
+    all_children.insert(all_children.begin() + child + 1, new_child);
+    int mid = all_keys.size() / 2;
+
+    char right[BTREE_NODE_SIZE];
+    memset(right, 0, sizeof(right));
+    BTreeNode *right_header = (BTreeNode *) right;
+    right_header->leaf = 0;
+    right_header->count = all_keys.size() - mid - 1;
+    memcpy(inner_keys(right), &all_keys[mid + 1], right_header->count * sizeof(IndexEntry));
+    memcpy(inner_children(right), &all_children[mid + 1], (right_header->count + 1) * sizeof(uint32_t));
+
+    header->count = mid;
+    memcpy(keys, &all_keys[0], mid * sizeof(IndexEntry));
+    memcpy(children, &all_children[0], (mid + 1) * sizeof(uint32_t));
+
+    *split_node = tree->num_nodes++;
+    write_node(tree, *split_node, right);
+    write_node(tree, id, node);
+    *split_key = all_keys[mid];
+    return true;
+}
+
+void index_insert(BTree *tree, const char *value, RecordID rid) {
+    IndexEntry entry;
+    memcpy(entry.value, value, ATTRIBUTE_SIZE);
+    entry.rid = rid;
+
+    IndexEntry key;
+    uint32_t new_child;
+    if (insert_entry(tree, tree->root, &entry, &key, &new_child)) {
+        // The root was split: grow the tree by one level.
+        char node[BTREE_NODE_SIZE];
+        memset(node, 0, sizeof(node));
+        BTreeNode *header = (BTreeNode *) node;
+        header->leaf = 0;
+        header->count = 1;
+        inner_children(node)[0] = tree->root;
+        inner_children(node)[1] = new_child;
+        inner_keys(node)[0] = key;
+        tree->root = tree->num_nodes++;
+        tree->height++;
+        write_node(tree, tree->root, node);
+    }
+    tree->num_entries++;
+}
+
+bool index_delete(BTree *tree, const char *value, RecordID rid) {
+    IndexEntry entry;
+    memcpy(entry.value, value, ATTRIBUTE_SIZE);
+    entry.rid = rid;
+
+    char node[BTREE_NODE_SIZE];
+    BTreeNode *header = (BTreeNode *) node;
+    uint32_t id = tree->root;
+    read_node(tree, id, node);
+    while (!header->leaf) {
+        id = inner_children(node)[child_for_entry(node, &entry)];
+        read_node(tree, id, node);
+    }
+
+    IndexEntry *entries = leaf_entries(node);
+    int pos = lower_bound_entry(entries, header->count, &entry);
+    if (pos == header->count || compare_entries(&entries[pos], &entry) != 0) {
+        return false;
+    }
+    memmove(&entries[pos], &entries[pos + 1], (header->count - pos - 1) * sizeof(IndexEntry));
+    header->count--;
+    write_node(tree, id, node);
+    tree->num_entries--;
+    return true;
+}
+
+void index_range(BTree *tree, const char *start, const char *end, vector<RecordID> *rids) {
+    rids->clear();
+    char node[BTREE_NODE_SIZE];
+    BTreeNode *header = (BTreeNode *) node;
+    read_node(tree, tree->root, node);
+    while (!header->leaf) {
+        // The first match is under the child before the first key >= start.
+        int child = lower_bound_value(inner_keys(node), header->count, start);
+        read_node(tree, inner_children(node)[child], node);
+    }
+
+    int pos = lower_bound_value(leaf_entries(node), header->count, start);
+    while (1) {
+        IndexEntry *entries = leaf_entries(node);
+        for (; pos < header->count; pos++) {
+            AttrView value = {entries[pos].value, ATTRIBUTE_SIZE};
+            if (compare_attr(value, end) > 0) {
+                return;
+            }
+            rids->push_back(entries[pos].rid);
+        }
+        if (header->next == 0) {
+            return;
+        }
+        read_node(tree, header->next, node);
+        pos = 0;
+    }
+}
+
+/*
+ * Hash indexes. The header page holds HASH_MAGIC, the attribute, the
+ * global depth, the directory page and the page count as uint32_t values,
+ * then the entry count and the first free page. The directory is
+ * 2^global_depth contiguous bucket page numbers; doubling it writes the
+ * new one at the end of the file and frees the old pages. A bucket page
+ * starts with a HashBucket header followed by its entries, in no
+ * particular order. Only the first page of a chain has a meaningful local
+ * depth. A free page starts with the number of the next free page.
+ */
+#define HASH_MAGIC 0x48534148 // "HASH"
+
+typedef struct {
+    uint32_t local_depth;
+    uint32_t count;
+    uint32_t next; // next page of the chain, 0 after the last one
+} HashBucket;
+
+#define HASH_BUCKET_CAPACITY ((int) ((HASH_PAGE_SIZE - sizeof(HashBucket)) / sizeof(IndexEntry)))
+#define HASH_SLOTS_PER_PAGE ((uint32_t) (HASH_PAGE_SIZE / sizeof(uint32_t)))
+
+static inline IndexEntry *bucket_entries(char *page) {
+    return (IndexEntry *) (page + sizeof(HashBucket));
+}
+
+static inline uint64_t hash_value(const char *value) {
+    uint64_t h = load64(value) * 0x9e3779b97f4a7c15ULL ^ load16(value + 8);
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 32);
+}
+
+static inline uint32_t depth_mask(uint32_t depth) {
+    return (uint32_t) ((1ULL << depth) - 1);
+}
+
+static void read_hash_page(HashIndex *index, uint32_t id, char *page) {
+    if (pread(fileno(index->file_ptr), page, HASH_PAGE_SIZE, (off_t) id * HASH_PAGE_SIZE) != HASH_PAGE_SIZE) {
+        fputs("Read error\n", stderr);
+        exit(2);
+    }
+}
+
+static void write_hash_page(HashIndex *index, uint32_t id, const char *page) {
+    if (pwrite(fileno(index->file_ptr), page, HASH_PAGE_SIZE, (off_t) id * HASH_PAGE_SIZE) != HASH_PAGE_SIZE) {
+        fputs("Write error\n", stderr);
+        exit(2);
+    }
+}
+
+static void write_hash_header(HashIndex *index) {
+    char page[HASH_PAGE_SIZE];
+    memset(page, 0, sizeof(page));
+    uint32_t header[5] = {HASH_MAGIC, (uint32_t) index->attr_id, index->global_depth, index->dir_page, index->num_pages};
+    memcpy(page, header, sizeof(header));
+    memcpy(page + sizeof(header), &index->num_entries, sizeof(uint64_t));
+    memcpy(page + sizeof(header) + sizeof(uint64_t), &index->free_page, sizeof(uint32_t));
+    write_hash_page(index, 0, page);
+}
+
+/**
+ * Take a page off the free list, or add one at the end of the file if
+ * it is empty.
+ */
+static uint32_t alloc_hash_page(HashIndex *index) {
+    if (index->free_page == 0) {
+        return index->num_pages++;
+    }
+    uint32_t id = index->free_page;
+    if (pread(fileno(index->file_ptr), &index->free_page, sizeof(uint32_t), (off_t) id * HASH_PAGE_SIZE)
+        != sizeof(uint32_t)) {
+        fputs("Read error\n", stderr);
+        exit(2);
+    }
+    return id;
+}
+
+static void free_hash_page(HashIndex *index, uint32_t id) {
+    char page[HASH_PAGE_SIZE];
+    memset(page, 0, sizeof(page));
+    memcpy(page, &index->free_page, sizeof(uint32_t));
+    write_hash_page(index, id, page);
+    index->free_page = id;
+}
+
+static off_t dir_slot_offset(HashIndex *index, uint32_t slot) {
+    return (off_t) index->dir_page * HASH_PAGE_SIZE + (off_t) slot * sizeof(uint32_t);
+}
+
+static uint32_t read_dir_slot(HashIndex *index, uint32_t slot) {
+    uint32_t id;
+    if (pread(fileno(index->file_ptr), &id, sizeof(id), dir_slot_offset(index, slot)) != sizeof(id)) {
+        fputs("Read error\n", stderr);
+        exit(2);
+    }
+    return id;
+}
+
+static void write_dir_slots(HashIndex *index, uint32_t first, const uint32_t *ids, uint32_t count) {
+    ssize_t size = (ssize_t) count * sizeof(uint32_t);
+    if (pwrite(fileno(index->file_ptr), ids, size, dir_slot_offset(index, first)) != size) {
+        fputs("Write error\n", stderr);
+        exit(2);
+    }
+}
+
+static inline uint32_t dir_pages(uint32_t global_depth) {
+    return ((1U << global_depth) + HASH_SLOTS_PER_PAGE - 1) / HASH_SLOTS_PER_PAGE;
+}
+
+/**
+ * Write count entries as a bucket chain, reusing the pages at the back
+ * of free first and allocating the rest with alloc_hash_page. Returns
+ * its first page.
+ */
+static uint32_t write_chain(HashIndex *index, const IndexEntry *entries, int count, uint32_t local_depth,
+                            vector<uint32_t> *free) {
+    int num_pages = max(1, (count + HASH_BUCKET_CAPACITY - 1) / HASH_BUCKET_CAPACITY);
+    vector<uint32_t> ids;
+    for (int p = 0; p < num_pages; p++) {
+        if (!free->empty()) {
+            ids.push_back(free->back());
+            free->pop_back();
+        } else {
+            ids.push_back(alloc_hash_page(index));
+        }
+    }
+
+    char page[HASH_PAGE_SIZE];
+    HashBucket *header = (HashBucket *) page;
+    for (int p = 0; p < num_pages; p++) {
+        int first = p * HASH_BUCKET_CAPACITY;
+        memset(page, 0, sizeof(page));
+        header->local_depth = local_depth;
+        header->count = min(count - first, HASH_BUCKET_CAPACITY);
+        header->next = (p + 1 < num_pages) ? ids[p + 1] : 0;
+        memcpy(bucket_entries(page), entries + first, header->count * sizeof(IndexEntry));
+        write_hash_page(index, ids[p], page);
+    }
+    return ids[0];
+}
+
+/**
+ * Split the full chain starting at page head, whose values hash like h,
+ * on bit local_depth, doubling the directory first if needed. Returns
+ * false without splitting if every value in it has hash h, as no split
+ * could separate them.
+ */
+static bool split_bucket(HashIndex *index, uint32_t head, uint32_t local_depth, uint64_t h) {
+    vector<IndexEntry> entries;
+    vector<uint32_t> chain;
+    char page[HASH_PAGE_SIZE];
+    HashBucket *header = (HashBucket *) page;
+    bool same_hash = true;
+    for (uint32_t id = head; id != 0; id = header->next) {
+        read_hash_page(index, id, page);
+        chain.push_back(id);
+        for (int i = 0; i < header->count; i++) {
+            entries.push_back(bucket_entries(page)[i]);
+            same_hash = same_hash && hash_value(bucket_entries(page)[i].value) == h;
+        }
+    }
+    if (same_hash) {
+        return false;
+    }
+
+    if (local_depth == index->global_depth) {
+        // The new directory is the old one twice over.
+        uint32_t num_slots = 1U << index->global_depth;
+        vector<uint32_t> slots(num_slots * 2);
+        ssize_t size = (ssize_t) num_slots * sizeof(uint32_t);
+        if (pread(fileno(index->file_ptr), &slots[0], size, dir_slot_offset(index, 0)) != size) {
+            fputs("Read error\n", stderr);
+            exit(2);
+        }
+        memcpy(&slots[num_slots], &slots[0], size);
+        uint32_t old_page = index->dir_page;
+        uint32_t old_pages = dir_pages(index->global_depth);
+        index->global_depth++;
+        index->dir_page = index->num_pages;
+        index->num_pages += dir_pages(index->global_depth);
+        write_dir_slots(index, 0, &slots[0], slots.size());
+        for (uint32_t p = 0; p < old_pages; p++) {
+            free_hash_page(index, old_page + p);
+        }
+    }
+
+    // Entries with bit local_depth clear go first and keep the head page.
+    uint64_t bit = 1ULL << local_depth;
+    int num_low = 0;
+    for (int i = 0; i < entries.size(); i++) {
+        if (!(hash_value(entries[i].value) & bit)) {
+            swap(entries[num_low++], entries[i]);
+        }
+    }
+    reverse(chain.begin(), chain.end());
+    write_chain(index, entries.data(), num_low, local_depth + 1, &chain);
+    uint32_t high = write_chain(index, entries.data() + num_low, entries.size() - num_low, local_depth + 1, &chain);
+    for (int i = 0; i < chain.size(); i++) {
+        free_hash_page(index, chain[i]);
+    }
+
+    // Of the slots that shared the chain, those with the bit set move to the new one.
+    uint32_t step = 1U << (local_depth + 1);
+    for (uint32_t slot = (h & depth_mask(local_depth)) | bit; slot < (1U << index->global_depth); slot += step) {
+        write_dir_slots(index, slot, &high, 1);
+    }
+    return true;
+}
+
+string hash_index_path(const char *heapfile_name, int attr_id) {
+    return string(heapfile_name) + "." + to_string(attr_id) + HASH_INDEX_SUFFIX;
+}
+
+void build_hash_index(HashIndex *index, FILE *file, Heapfile *heapfile, int attr_id) {
+    vector<IndexEntry> entries;
+    vector<uint64_t> hashes;
+    RecordIterator *it = new RecordIterator(heapfile);
+    RecordBatch batch;
+    while (it->next_batch(&batch, RECORD_BATCH_SIZE) > 0) {
+        for (int row = 0; row < batch.size; row++) {
+            RecordView record = batch_row(&batch, row);
+            IndexEntry entry;
+            memcpy(entry.value, record_view_attr(&record, attr_id).data, ATTRIBUTE_SIZE);
+            entry.rid.page_id = batch.page_id;
+            entry.rid.slot = batch.slots[row];
+            entries.push_back(entry);
+            hashes.push_back(hash_value(entry.value));
+        }
+    }
+    delete it;
+
+    // Enough buckets to leave room for later inserts.
+    index->file_ptr = file;
+    index->attr_id = attr_id;
+    index->global_depth = 0;
+    index->num_entries = entries.size();
+    index->free_page = 0;
+    size_t bucket_fill = max(1, HASH_BUCKET_CAPACITY * HASH_FILL_PERCENT / 100);
+    while (index->global_depth < HASH_MAX_DEPTH && ((size_t) 1 << index->global_depth) * bucket_fill < entries.size()) {
+        index->global_depth++;
+    }
+    uint32_t num_slots = 1U << index->global_depth;
+    uint32_t mask = depth_mask(index->global_depth);
+
+    // Group the entries by slot, keeping heapfile order within a slot.
+    vector<uint32_t> starts(num_slots + 1, 0);
+    for (int i = 0; i < entries.size(); i++) {
+        starts[(hashes[i] & mask) + 1]++;
+    }
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+        starts[slot + 1] += starts[slot];
+    }
+    vector<IndexEntry> grouped(entries.size());
+    vector<uint32_t> next(starts.begin(), starts.end() - 1);
+    for (int i = 0; i < entries.size(); i++) {
+        grouped[next[hashes[i] & mask]++] = entries[i];
+    }
+
+    // The directory, then one chain per slot.
+    index->dir_page = 1;
+    index->num_pages = 1 + dir_pages(index->global_depth);
+    vector<uint32_t> slots(num_slots);
+    vector<uint32_t> no_pages;
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+        slots[slot] = write_chain(index, grouped.data() + starts[slot], starts[slot + 1] - starts[slot],
+                                  index->global_depth, &no_pages);
+    }
+    write_dir_slots(index, 0, &slots[0], num_slots);
+    write_hash_header(index);
+}
+
+bool open_hash_index(HashIndex *index, FILE *file) {
+    char page[HASH_PAGE_SIZE];
+    uint32_t header[5];
+    if (pread(fileno(file), page, HASH_PAGE_SIZE, 0) != HASH_PAGE_SIZE) {
+        return false;
+    }
+    memcpy(header, page, sizeof(header));
+    if (header[0] != HASH_MAGIC) {
+        return false;
+    }
+    index->file_ptr = file;
+    index->attr_id = header[1];
+    index->global_depth = header[2];
+    index->dir_page = header[3];
+    index->num_pages = header[4];
+    memcpy(&index->num_entries, page + sizeof(header), sizeof(uint64_t));
+    memcpy(&index->free_page, page + sizeof(header) + sizeof(uint64_t), sizeof(uint32_t));
+    return true;
+}
+
+void close_hash_index(HashIndex *index) {
+    write_hash_header(index);
+    fclose(index->file_ptr);
+}
+
+void hash_index_insert(HashIndex *index, const char *value, RecordID rid) {
+    IndexEntry entry;
+    memcpy(entry.value, value, ATTRIBUTE_SIZE);
+    entry.rid = rid;
+    uint64_t h = hash_value(value);
+
+    char page[HASH_PAGE_SIZE];
+    HashBucket *header = (HashBucket *) page;
+    while (1) {
+        uint32_t head = read_dir_slot(index, h & depth_mask(index->global_depth));
+        uint32_t id = head;
+        read_hash_page(index, id, page);
+        uint32_t local_depth = header->local_depth;
+        while (header->count == HASH_BUCKET_CAPACITY && header->next != 0) {
+            id = header->next;
+            read_hash_page(index, id, page);
+        }
+        if (header->count < HASH_BUCKET_CAPACITY) {
+            bucket_entries(page)[header->count++] = entry;
+            write_hash_page(index, id, page);
+            break;
+        }
+        if (local_depth < HASH_MAX_DEPTH && split_bucket(index, head, local_depth, h)) {
+            continue;
+        }
+
+        // Too many entries share the hash: chain an overflow page.
+        uint32_t overflow = alloc_hash_page(index);
+        header->next = overflow;
+        write_hash_page(index, id, page);
+        memset(page, 0, sizeof(page));
+        header->local_depth = local_depth;
+        header->count = 1;
+        bucket_entries(page)[0] = entry;
+        write_hash_page(index, overflow, page);
+        break;
+    }
+    index->num_entries++;
+}
+
+bool hash_index_delete(HashIndex *index, const char *value, RecordID rid) {
+    char page[HASH_PAGE_SIZE];
+    HashBucket *header = (HashBucket *) page;
+    uint32_t id = read_dir_slot(index, hash_value(value) & depth_mask(index->global_depth));
+    for (; id != 0; id = header->next) {
+        read_hash_page(index, id, page);
+        IndexEntry *entries = bucket_entries(page);
+        for (int i = 0; i < header->count; i++) {
+            if (memcmp(entries[i].value, value, ATTRIBUTE_SIZE) == 0 && entries[i].rid.page_id == rid.page_id
+                && entries[i].rid.slot == rid.slot) {
+                entries[i] = entries[--header->count];
+                write_hash_page(index, id, page);
+                index->num_entries--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void hash_index_lookup(HashIndex *index, const char *value, vector<RecordID> *rids) {
+    rids->clear();
+    char page[HASH_PAGE_SIZE];
+    HashBucket *header = (HashBucket *) page;
+    uint32_t id = read_dir_slot(index, hash_value(value) & depth_mask(index->global_depth));
+    for (; id != 0; id = header->next) {
+        read_hash_page(index, id, page);
+        IndexEntry *entries = bucket_entries(page);
+        for (int i = 0; i < header->count; i++) {
+            if (memcmp(entries[i].value, value, ATTRIBUTE_SIZE) == 0) {
+                rids->push_back(entries[i].rid);
+            }
+        }
+    }
+}
+
+/*
+ * Bloom filters. The BLOOM_HASHES bits of a value come from the two
+ * halves of its hash (double hashing). The sidecar holds BLOOM_MAGIC, the
+ * words per filter and the number of filtered attributes as uint32_t
+ * values, then for each of them its id, its number of words (uint64_t)
+ * and the words.
+ */
+#define BLOOM_MAGIC 0x4d4f4f4c // "LOOM"
+
+string bloom_path(const char *name) {
+    return string(name) + BLOOM_SUFFIX;
+}
+
+void init_bloom_filters(BloomFilters *bloom, int values_per_page, const vector<int> &attrs) {
+    bloom->file_ptr = NULL;
+    bloom->words = max(1, (values_per_page * BLOOM_BITS_PER_VALUE + 63) / 64);
+    bloom->dirty = true;
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        bloom->filters[attr] = NULL;
+    }
+    for (int i = 0; i < attrs.size(); i++) {
+        if (bloom->filters[attrs[i]] == NULL) {
+            bloom->filters[attrs[i]] = new vector<uint64_t>;
+        }
+    }
+}
+
+void bloom_add(BloomFilters *bloom, int attr_id, long i, const char *value) {
+    vector<uint64_t> *filters = bloom->filters[attr_id];
+    if ((size_t) (i + 1) * bloom->words > filters->size()) {
+        filters->resize((size_t) (i + 1) * bloom->words);
+    }
+    uint64_t *filter = &filters->at((size_t) i * bloom->words);
+    uint64_t h = hash_value(value);
+    uint32_t bits = bloom->words * 64;
+    uint32_t step = (uint32_t) (h >> 32) | 1;
+    for (int k = 0; k < BLOOM_HASHES; k++) {
+        uint32_t bit = (uint32_t) (h + (uint64_t) k * step) % bits;
+        filter[bit / 64] |= 1ULL << (bit % 64);
+    }
+    bloom->dirty = true;
+}
+
+bool bloom_may_contain(BloomFilters *bloom, int attr_id, long i, const char *value) {
+    vector<uint64_t> *filters = bloom->filters[attr_id];
+    if (filters == NULL || (size_t) (i + 1) * bloom->words > filters->size()) {
+        return true;
+    }
+    const uint64_t *filter = &filters->at((size_t) i * bloom->words);
+    uint64_t h = hash_value(value);
+    uint32_t bits = bloom->words * 64;
+    uint32_t step = (uint32_t) (h >> 32) | 1;
+    for (int k = 0; k < BLOOM_HASHES; k++) {
+        uint32_t bit = (uint32_t) (h + (uint64_t) k * step) % bits;
+        if (!((filter[bit / 64] >> (bit % 64)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void write_bloom_filters(BloomFilters *bloom, FILE *file) {
+    uint32_t num_attrs = 0;
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        num_attrs += (bloom->filters[attr] != NULL);
+    }
+    uint32_t header[3] = {BLOOM_MAGIC, (uint32_t) bloom->words, num_attrs};
+    fwrite_with_check(header, sizeof(header), 1, file);
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        vector<uint64_t> *filters = bloom->filters[attr];
+        if (filters == NULL) {
+            continue;
+        }
+        uint32_t id = attr;
+        uint64_t size = filters->size();
+        fwrite_with_check(&id, sizeof(uint32_t), 1, file);
+        fwrite_with_check(&size, sizeof(uint64_t), 1, file);
+        if (size > 0) {
+            fwrite_with_check(&filters->at(0), size * sizeof(uint64_t), 1, file);
+        }
+    }
+}
+
+bool read_bloom_filters(BloomFilters *bloom, FILE *file) {
+    uint32_t header[3];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != BLOOM_MAGIC || header[1] == 0) {
+        return false;
+    }
+    bloom->file_ptr = NULL;
+    bloom->words = header[1];
+    bloom->dirty = false;
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        bloom->filters[attr] = NULL;
+    }
+    for (int a = 0; a < header[2]; a++) {
+        uint32_t id;
+        uint64_t size;
+        if (fread(&id, sizeof(uint32_t), 1, file) != 1 || fread(&size, sizeof(uint64_t), 1, file) != 1
+            || id >= ATTR_PER_RECORD || bloom->filters[id] != NULL) {
+            free_bloom_filters(bloom);
+            return false;
+        }
+        bloom->filters[id] = new vector<uint64_t>(size);
+        if (size > 0) {
+            fread_with_check(&bloom->filters[id]->at(0), size * sizeof(uint64_t), 1, file);
+        }
+    }
+    return true;
+}
+
+void free_bloom_filters(BloomFilters *bloom) {
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        delete bloom->filters[attr];
+        bloom->filters[attr] = NULL;
+    }
+}
+
+bool open_bloom_filters(Heapfile *heapfile, const char *heapfile_name, const vector<int> *attrs) {
+    string path = bloom_path(heapfile_name);
+    if (attrs != NULL && heapfile->number_of_page != 0) {
+        fputs("Bloom filters can only be created for an empty heapfile\n", stderr);
+        exit(2);
+    }
+    FILE *file = fopen(path.c_str(), (attrs != NULL) ? "wb+" : "rb+");
+    if (file == NULL) {
+        return false;
+    }
+
+    BloomFilters *bloom = new BloomFilters;
+    if (attrs != NULL) {
+        init_bloom_filters(bloom, heapfile->page_size / heapfile->slot_size, *attrs);
+    } else if (!read_bloom_filters(bloom, file)) {
+        fprintf(stderr, "%s holds no Bloom filters\n", path.c_str());
+        fclose(file);
+        delete bloom;
+        return false;
+    }
+    bloom->file_ptr = file;
+    heapfile->bloom = bloom;
+    return true;
+}
+
+/**
+ * Rebuild the Bloom filters of page pid, which has just been written, so
+ * values of deleted records leave them too.
+ */
+void update_bloom_filters(Heapfile *heapfile, PageID pid, Page *page) {
+    BloomFilters *bloom = heapfile->bloom;
+    if (bloom == NULL) {
+        return;
+    }
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        vector<uint64_t> *filters = bloom->filters[attr];
+        if (filters == NULL) {
+            continue;
+        }
+        if ((size_t) pid * bloom->words > filters->size()) {
+            filters->resize((size_t) pid * bloom->words);
+        }
+        memset(&filters->at((size_t) (pid - 1) * bloom->words), 0, bloom->words * sizeof(uint64_t));
+        for (int slot = 0; slot < fixed_len_page_capacity(page); slot++) {
+            if (slot_is_used(page, slot)) {
+                bloom_add(bloom, attr, pid - 1, (const char *) page->data + slot * page->slot_size
+                                                + attr * ATTRIBUTE_SIZE);
+            }
+        }
+    }
+    bloom->dirty = true;
+}
+
+/**
+ * Rewrite the Bloom filter sidecar if the filters changed.
+ */
+void flush_bloom_filters(Heapfile *heapfile) {
+    BloomFilters *bloom = heapfile->bloom;
+    if (bloom == NULL || !bloom->dirty) {
+        return;
+    }
+    fseek(bloom->file_ptr, 0, SEEK_SET);
+    write_bloom_filters(bloom, bloom->file_ptr);
+    fflush(bloom->file_ptr);
+    bloom->dirty = false;
+}
+
+void bloom_filter_pages(Heapfile *heapfile, int attr_id, const char *value, vector<PageID> *pages) {
+    if (heapfile->bloom == NULL) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < pages->size(); i++) {
+        if (bloom_may_contain(heapfile->bloom, attr_id, pages->at(i) - 1, value)) {
+            pages->at(kept++) = pages->at(i);
+        }
+    }
+    pages->resize(kept);
+}
+
+int open_indexes(Heapfile *heapfile, const char *heapfile_name) {
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        FILE *file = fopen(index_path(heapfile_name, attr).c_str(), "rb+");
+        if (file == NULL) {
+            continue;
+        }
+        BTree *tree = new BTree;
+        if (!open_index(tree, file) || tree->attr_id != attr) {
+            fprintf(stderr, "%s is not an index\n", index_path(heapfile_name, attr).c_str());
+            fclose(file);
+            delete tree;
+            continue;
+        }
+        heapfile->indexes->push_back(tree);
+    }
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        FILE *file = fopen(hash_index_path(heapfile_name, attr).c_str(), "rb+");
+        if (file == NULL) {
+            continue;
+        }
+        HashIndex *index = new HashIndex;
+        if (!open_hash_index(index, file) || index->attr_id != attr) {
+            fprintf(stderr, "%s is not a hash index\n", hash_index_path(heapfile_name, attr).c_str());
+            fclose(file);
+            delete index;
+            continue;
+        }
+        heapfile->hash_indexes->push_back(index);
+    }
+    return heapfile->indexes->size() + heapfile->hash_indexes->size();
+}
+
+void update_indexes(Heapfile *heapfile, RecordID rid, const char *old_row, const char *new_row) {
+    for (int i = 0; i < heapfile->indexes->size(); i++) {
+        BTree *tree = heapfile->indexes->at(i);
+        int offset = tree->attr_id * ATTRIBUTE_SIZE;
+        if (old_row != NULL && new_row != NULL && memcmp(old_row + offset, new_row + offset, ATTRIBUTE_SIZE) == 0) {
+            continue;
+        }
+        if (old_row != NULL) {
+            index_delete(tree, old_row + offset, rid);
+        }
+        if (new_row != NULL) {
+            index_insert(tree, new_row + offset, rid);
+        }
+    }
+    for (int i = 0; i < heapfile->hash_indexes->size(); i++) {
+        HashIndex *index = heapfile->hash_indexes->at(i);
+        int offset = index->attr_id * ATTRIBUTE_SIZE;
+        if (old_row != NULL && new_row != NULL && memcmp(old_row + offset, new_row + offset, ATTRIBUTE_SIZE) == 0) {
+            continue;
+        }
+        if (old_row != NULL) {
+            hash_index_delete(index, old_row + offset, rid);
+        }
+        if (new_row != NULL) {
+            hash_index_insert(index, new_row + offset, rid);
+        }
+    }
+}
+
+void remove_indexes(const char *heapfile_name) {
+    for (int attr = 0; attr < ATTR_PER_RECORD; attr++) {
+        remove(index_path(heapfile_name, attr).c_str());
+        remove(hash_index_path(heapfile_name, attr).c_str());
+    }
+}
+
+bool read_record_ops(FILE *file, bool updates, vector<RecordOp> *ops) {
+    char line[256];
+    char value[256];
+    long line_no = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] != '\n' && !feof(file)) {
+            fprintf(stderr, "line %ld: longer than %d characters\n", line_no, (int) sizeof(line) - 2);
+            return false;
+        }
+        if (strspn(line, " \t\r\n") == len) {
+            continue; // blank line
+        }
+        RecordOp op;
+        op.attr_id = -1;
+        int end = -1; // where the fields stop, only whitespace may follow
+        int fields = updates ? sscanf(line, "%d-%d %d %255s%n", &op.rid.page_id, &op.rid.slot, &op.attr_id, value, &end)
+                             : sscanf(line, "%d-%d%n", &op.rid.page_id, &op.rid.slot, &end);
+        if (fields != (updates ? 4 : 2) || end < 0 || strspn(line + end, " \t\r\n") != len - end
+            || op.rid.page_id <= 0 || op.rid.slot < 0
+            || (updates && (op.attr_id < 0 || op.attr_id >= ATTR_PER_RECORD || strlen(value) > ATTRIBUTE_SIZE))) {
+            fprintf(stderr, "line %ld: expected %s\n", line_no,
+                    updates ? "<page_id>-<slot> <attribute_id> <new_value>" : "<page_id>-<slot>");
+            return false;
+        }
+        memset(op.value, ' ', ATTRIBUTE_SIZE);
+        if (updates) {
+            memcpy(op.value, value, strlen(value));
+        }
+        ops->push_back(op);
+    }
+    return true;
+}
+
+struct OpPageOrder {
+    bool operator()(const RecordOp &a, const RecordOp &b) const {
+        return a.rid.page_id < b.rid.page_id;
+    }
+};
+
+long apply_record_ops(Heapfile *heapfile, vector<RecordOp> *ops) {
+    stable_sort(ops->begin(), ops->end(), OpPageOrder());
+
+    long applied = 0;
+    vector<char> old_row;
+    for (int first = 0; first < ops->size();) {
+        PageID pid = ops->at(first).rid.page_id;
+        int last = first;
+        while (last < ops->size() && ops->at(last).rid.page_id == pid) {
+            last++;
+        }
+        Page *page = (pid <= heapfile->number_of_page) ? pin_page(heapfile, pid) : NULL;
+        if (page == NULL) {
+            first = last;
+            continue;
+        }
+
+        bool dirty = false;
+        for (int i = first; i < last; i++) {
+            RecordOp *op = &ops->at(i);
+            int slot = op->rid.slot;
+            if (slot >= fixed_len_page_capacity(page) || !slot_is_used(page, slot)) {
+                continue;
+            }
+            char *row = (char *) page->data + slot * page->slot_size;
+            if (op->attr_id == -1) {
+                update_indexes(heapfile, op->rid, row, NULL);
+                set_slot_used(page, slot, false);
+            } else {
+                old_row.assign(row, row + page->slot_size);
+                memcpy(row + op->attr_id * ATTRIBUTE_SIZE, op->value, ATTRIBUTE_SIZE);
+                update_indexes(heapfile, op->rid, &old_row[0], row);
+            }
+            dirty = true;
+            applied++;
+        }
+        unpin_page(heapfile, pid, dirty);
+        first = last;
+    }
+    return applied;
+}
+
+/**
+ * Walk the directory chain once, reading each directory page whole,
+ * and keep every page offset in memory.
+ */
+void load_directory(Heapfile *heapfile) {
+    int page_size = heapfile->page_size;
+    int number_of_pages_per_dir = get_number_of_pages(page_size);
+    int entry_size = get_entry_size(page_size);
+    int free_space_size = get_free_space_size(page_size);
+    FILE *file = heapfile->file_ptr;
+
+    char *dir = (char *) malloc(page_size);
+    uint32_t dir_offset = HEAPFILE_HEADER_SIZE;
+    uint32_t pid = 0;
+
+    heapfile->page_offsets->reserve(heapfile->number_of_page);
+    while (dir_offset != 0) {
+        heapfile->dir_offsets->push_back(dir_offset);
+        fseek(file, dir_offset + sizeof(Page), SEEK_SET);
+        if (fread_with_check(dir, page_size, 1, file) != 1) {
+            break;
+        }
+
+        for (int i = 0; i < number_of_pages_per_dir && pid < heapfile->number_of_page; i++, pid++) {
+            uint32_t offset;
+            int free_space = 0;
+            memcpy(&offset, dir + OFFSET_SIZE + i * entry_size, OFFSET_SIZE);
+            memcpy(&free_space, dir + 2 * OFFSET_SIZE + i * entry_size, free_space_size);
+            heapfile->page_offsets->push_back(offset);
+            fsm_update(heapfile, pid + 1, free_space);
+        }
+        if (pid >= heapfile->number_of_page) {
+            break;
+        }
+        memcpy(&dir_offset, dir, OFFSET_SIZE);
+    }
+    free(dir);
+
+    if (pid < heapfile->number_of_page) {
+        fputs("Heapfile directory is truncated\n", stderr);
+        heapfile->number_of_page = pid;
+    }
+}
+
+/*
+ * Buffer pool: a fixed number of page frames shared by all open heapfiles.
+ * Frames are replaced with the clock algorithm and dirty frames are only
+ * written back on eviction or flush.
+ */
+typedef struct {
+    Heapfile *heapfile;
+    PageID pid;
+    Page page;
+    int data_size;
+    int bitmap_words;
+    int pin_count;
+    bool dirty;
+    bool referenced;
+} Frame;
+
+void write_frame(Frame *frame);
+void reserve_bitmap(Frame *frame, int num_words);
+
+static vector<Frame> frames;
+static map<pair<Heapfile *, PageID>, int> frame_table;
+static int clock_hand = 0;
+static BufferPoolStats stats;
+
+/**
+ * Size the buffer pool to num_frames pages.
+ */
+void init_buffer_pool(int num_frames) {
+    assert(num_frames > 0);
+    assert(frame_table.empty());
+
+    frames.clear();
+    frames.resize(num_frames);
+    for (int i = 0; i < num_frames; i++) {
+        frames[i].heapfile = NULL;
+        frames[i].page.data = NULL;
+        frames[i].page.slot_bitmap = NULL;
+        frames[i].data_size = 0;
+        frames[i].bitmap_words = 0;
+    }
+    clock_hand = 0;
+}
+
+/**
+ * Pin a page in the buffer pool and return the buffered copy.
+ */
+Page *pin_page(Heapfile *heapfile, PageID pid) {
+    return fetch_frame(heapfile, pid, true, 0);
+}
+
+/**
+ * Release a pin taken by pin_page.
+ */
+void unpin_page(Heapfile *heapfile, PageID pid, bool dirty) {
+    map<pair<Heapfile *, PageID>, int>::iterator it = frame_table.find(make_pair(heapfile, pid));
+    assert(it != frame_table.end());
+
+    Frame *frame = &frames[it->second];
+    assert(frame->pin_count > 0);
+    frame->pin_count--;
+    frame->dirty = frame->dirty || dirty;
+
+    if (dirty) {
+        set_page_free_slots(heapfile, pid, fixed_len_page_freeslots(&frame->page));
+    }
+}
+
+/**
+ * Write all dirty buffered pages of the heapfile back to disk.
+ */
+void flush_heapfile(Heapfile *heapfile) {
+    for (int i = 0; i < frames.size(); i++) {
+        if (frames[i].heapfile == heapfile && frames[i].dirty) {
+            write_frame(&frames[i]);
+        }
+    }
+    flush_zone_map(heapfile);
+    flush_bloom_filters(heapfile);
+}
+
+void prefetch_pages(Heapfile *heapfile, PageID first, PageID last) {
+    if (first < 1) {
+        first = 1;
+    }
+    if (last > (PageID) heapfile->page_offsets->size()) {
+        last = heapfile->page_offsets->size();
+    }
+
+    Page page;
+    page.page_size = heapfile->page_size;
+    page.slot_size = heapfile->slot_size;
+    off_t page_bytes = sizeof(Page) + slot_bitmap_size(&page) + heapfile->page_size;
+    int fd = fileno(heapfile->file_ptr);
 
-    int num_slots = fixed_len_page_capacity(page);
-    for (int i = 0; i < num_slots; i++)
-        page->slot_info->push_back('0');
+    // Data pages are contiguous between directory pages: advise whole runs.
+    PageID pid = first;
+    while (pid <= last) {
+        off_t start = heapfile->page_offsets->at(pid - 1);
+        off_t end = start + page_bytes;
+        pid++;
+        while (pid <= last && heapfile->page_offsets->at(pid - 1) == end) {
+            end += page_bytes;
+            pid++;
+        }
+        posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+    }
 }
 
-/**
- * Calculates the maximal number of records/slots that fit in a page
- */
-int fixed_len_page_capacity(Page *page) {
-    return (page->page_size / page->slot_size);
+BufferPoolStats buffer_pool_stats() {
+    return stats;
+}
+
+void print_buffer_pool_stats(FILE *out) {
+    fprintf(out, "BUFFER POOL: %ld hits, %ld misses, %ld evictions, %ld write-backs\n",
+            stats.hits, stats.misses, stats.evictions, stats.write_backs);
 }
 
 /**
- * Calculate the free space (number of free slots) in the page
+ * Find the frame holding page pid, bringing it into the pool on a miss.
+ * When load is false the caller overwrites the whole page, so a missing
+ * page is not read from disk; num_words is then the bitmap size it needs.
+ * Returns NULL if the page does not exist.
  */
-int fixed_len_page_freeslots(Page *page) {
-    
-    int num_free = 0;
-    //std::vector<char>::iterator it;
-    for (int i = 0; i < page->slot_info->size(); i++){
-        if (page->slot_info->at(i) == '0')
-            num_free++;
+Page *fetch_frame(Heapfile *heapfile, PageID pid, bool load, int num_words) {
+    if (frames.empty()) {
+        init_buffer_pool(DEFAULT_BUFFER_POOL_FRAMES);
+    }
+
+    map<pair<Heapfile *, PageID>, int>::iterator it = frame_table.find(make_pair(heapfile, pid));
+    if (it != frame_table.end()) {
+        Frame *frame = &frames[it->second];
+        frame->pin_count++;
+        frame->referenced = true;
+        reserve_bitmap(frame, num_words);
+        stats.hits++;
+        return &frame->page;
+    }
+
+    if (reach_page(heapfile, pid) == -1) {
+        return NULL;
+    }
+    stats.misses++;
+
+    int victim = find_victim();
+    Frame *frame = &frames[victim];
+    if (frame->data_size < heapfile->page_size) {
+        free(frame->page.data);
+        frame->page.data = malloc(heapfile->page_size);
+        frame->data_size = heapfile->page_size;
+    }
+    frame->heapfile = heapfile;
+    frame->pid = pid;
+    frame->pin_count = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+
+    if (load) {
+        // Evicting a dirty victim may have moved the file position.
+        reach_page(heapfile, pid);
+        void *data = frame->page.data;
+        uint64_t *slot_bitmap = frame->page.slot_bitmap;
+        fread_with_check(&frame->page, sizeof(Page), 1, heapfile->file_ptr);
+        frame->page.data = data;
+        frame->page.slot_bitmap = slot_bitmap;
+
+        int num_slots = fixed_len_page_capacity(&frame->page);
+        reserve_bitmap(frame, slot_bitmap_words(num_slots));
+        memset(frame->page.slot_bitmap, 0, slot_bitmap_words(num_slots) * sizeof(uint64_t));
+        fread_with_check(frame->page.slot_bitmap, slot_bitmap_size(&frame->page), 1, heapfile->file_ptr);
+        fread_with_check(data, heapfile->page_size, 1, heapfile->file_ptr);
+    } else {
+        reserve_bitmap(frame, num_words);
     }
+    frame_table[make_pair(heapfile, pid)] = victim;
 
-    return num_free; 
+    return &frame->page;
 }
- 
+
 /**
- * Add a record to the page
- * Returns:
- *   record slot offset if successful,
- *   -1 if unsuccessful (page full)
+ * Pick a frame to reuse with the clock algorithm, writing it back if dirty.
  */
-int add_fixed_len_page(Page *page, Record *r){
-    int free_slots = fixed_len_page_freeslots(page);
-    if (free_slots > 0) {
-        for (int ind = 0; ind < page->slot_info->size(); ind++){
-            if (page->slot_info->at(ind) == '0'){
-                write_fixed_len_page(page, ind, r);
-                page->slot_info->at(ind) = '1';
-                return ind;
-            }
+int find_victim() {
+    int num_frames = frames.size();
+    for (int sweep = 0; sweep < 2 * num_frames; sweep++) {
+        Frame *frame = &frames[clock_hand];
+        int candidate = clock_hand;
+        clock_hand = (clock_hand + 1) % num_frames;
+
+        if (frame->heapfile == NULL) {
+            return candidate;
         }
-    
+        if (frame->pin_count > 0) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+
+        if (frame->dirty) {
+            write_frame(frame);
+        }
+        frame_table.erase(make_pair(frame->heapfile, frame->pid));
+        frame->heapfile = NULL;
+        stats.evictions++;
+        return candidate;
     }
-    return -1;
-}
- 
-/**
- * Write a record into a given slot.
- */
-void write_fixed_len_page(Page *page, int slot, Record *r){
-    char *buf = ((char *)page->data + (slot * page->slot_size));
-    fixed_len_write(r, buf);
+
+    fputs("Buffer pool error: all frames are pinned\n", stderr);
+    exit(2);
 }
- 
-/**
- * Read a record from the page from a given slot.
- */
-void read_fixed_len_page(Page *page, int slot, Record *r){
-    if (page->slot_info->at(slot) == '0' || slot >= fixed_len_page_capacity(page))
+
+void write_frame(Frame *frame) {
+    Heapfile *heapfile = frame->heapfile;
+    Page *page = &frame->page;
+    if (reach_page(heapfile, frame->pid) == -1) {
         return;
+    }
 
-    int slotSize = page->slot_size;
+    fwrite_with_check(page, sizeof(Page), 1, heapfile->file_ptr);
+    fwrite_with_check(page->slot_bitmap, slot_bitmap_size(page), 1, heapfile->file_ptr);
+    fwrite_with_check(page->data, heapfile->page_size, 1, heapfile->file_ptr);
+    update_zone_map(heapfile, frame->pid, page);
+    update_bloom_filters(heapfile, frame->pid, page);
 
-    char *buf = ((char * )page->data + (slot * slotSize));
-    fixed_len_read(buf, slotSize, r);
+    frame->dirty = false;
+    stats.write_backs++;
+}
+
+void reserve_bitmap(Frame *frame, int num_words) {
+    if (frame->bitmap_words < num_words) {
+        free(frame->page.slot_bitmap);
+        frame->page.slot_bitmap = (uint64_t *) malloc(num_words * sizeof(uint64_t));
+        frame->bitmap_words = num_words;
+    }
 }
 
+void drop_frames(Heapfile *heapfile) {
+    for (int i = 0; i < frames.size(); i++) {
+        if (frames[i].heapfile == heapfile) {
+            frame_table.erase(make_pair(heapfile, frames[i].pid));
+            frames[i].heapfile = NULL;
+        }
+    }
+}
 
 /**
- * Initalize a heapfile to use the file and page size given.
+ * Read lines in file into page. Return when page is full.
  */
-void init_heapfile(Heapfile *heapfile, int page_size, FILE *file) {
-    heapfile->page_size = page_size;
-    heapfile->number_of_page = 0;
-
-    Page *first_page = new Page();
-    init_fixed_len_page(first_page, page_size, SLOT_SIZE);
-
-    fwrite(heapfile, sizeof(Heapfile), 1, file);
-    fwrite(first_page, sizeof(Page), 1, file);
-    fwrite(first_page->data, page_size, 1, file);
-
-    free(first_page->data);
+int read_csv2page(ifstream *file, Page *page) {
+    int free_space = fixed_len_page_freeslots(page);
+    string line;
+    vector<char> row;
+    int numRecs = 0;
 
-    heapfile->file_ptr = file;
+    while (free_space > 0 && getline(*file, line)) {
+        if (tokenize_csv(line.data(), line.data() + line.size(), &row, NULL) == 0) {
+            continue;
+        }
+        add_fixed_len_slot(page, row.data());
+        free_space--;
+        numRecs++;
+    }
+    return numRecs;
 }
 
-/**
- * Allocate another page in the heapfile.  This grows the file by a page.
- */
-PageID alloc_page(Heapfile *heapfile) {
-    int page_size = heapfile->page_size;
-    int pid = heapfile->number_of_page + 1;
-    FILE *file = heapfile->file_ptr;
+typedef uint64_t (*CsvDelimitersKernel)(const char *);
 
-    int number_of_pages_per_dir = get_number_of_pages(page_size);
-    int nth_dir = (pid - 1) / number_of_pages_per_dir;
-    int order_in_dir = (pid - 1) % number_of_pages_per_dir;
+static CsvDelimitersKernel pick_csv_kernel() {
+#ifdef HAVE_X86_SIMD
+    return cpu_has_avx2() ? csv_delimiters_avx2 : csv_delimiters_sse2;
+#else
+    return csv_delimiters_scalar;
+#endif
+}
 
-    fseek(file, sizeof(Heapfile), SEEK_SET);
+uint64_t csv_delimiters(const char *p) {
+    // Parser threads call this concurrently; a local static is initialized once.
+    static const CsvDelimitersKernel kernel = pick_csv_kernel();
+    return kernel(p);
+}
 
-    for (int i = 0; i < nth_dir; i++) {
-        fseek(file, sizeof(Page), SEEK_CUR);
-        uint32_t offset_at = ftell(file);
-        uint32_t next_dir_offset = read_offset(file);
-        if (next_dir_offset == 0) {
-            next_dir_offset = alloc_page_at_end(file, page_size, true);
-            fseek(file, offset_at, SEEK_SET);
-            fwrite_with_check(&next_dir_offset, OFFSET_SIZE, 1, file);
+uint64_t csv_delimiters_scalar(const char *p) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++) {
+        if (p[i] == ',' || p[i] == '"' || p[i] == '\n') {
+            mask |= (uint64_t) 1 << i;
         }
-        fseek(file, next_dir_offset, SEEK_SET);
     }
-    fseek(file, sizeof(Page) + OFFSET_SIZE, SEEK_CUR);
-    fseek(file, order_in_dir * get_entry_size(page_size), SEEK_CUR);
+    return mask;
+}
 
-    uint32_t offset = alloc_page_at_end(file, page_size, false);
+#ifdef HAVE_X86_SIMD
+uint64_t csv_delimiters_sse2(const char *p) {
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
 
-    // Create new entry.
-    fwrite_with_check(&offset, OFFSET_SIZE, 1, file);
-    fwrite_with_check(&page_size, get_free_space_size(page_size), 1, file);
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, quote)),
+                                   _mm_cmpeq_epi8(v, newline));
+        mask |= (uint64_t) (uint32_t) _mm_movemask_epi8(hit) << i;
+    }
+    return mask;
+}
 
-    heapfile->number_of_page = pid;
+__attribute__((target("avx2")))
+uint64_t csv_delimiters_avx2(const char *p) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i newline = _mm256_set1_epi8('\n');
 
-    fseek(file, 0, SEEK_SET);
-    fwrite(heapfile, sizeof(Heapfile), 1, file);
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, comma), _mm256_cmpeq_epi8(v, quote)),
+                                      _mm256_cmpeq_epi8(v, newline));
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(hit) << i;
+    }
+    return mask;
+}
+#else
+uint64_t csv_delimiters_sse2(const char *p) {
+    return csv_delimiters_scalar(p);
+}
 
-    return heapfile->number_of_page;
+uint64_t csv_delimiters_avx2(const char *p) {
+    return csv_delimiters_scalar(p);
 }
+#endif
 
-/**
- * Read a page into memory
- */
-void read_page(Heapfile *heapfile, PageID pid, Page *page) {
-    int page_size = heapfile->page_size;
-    FILE *file = heapfile->file_ptr;
-    if (reach_page(heapfile, pid) == -1) {
-        page->data = NULL;
+static void add_csv_error(CsvErrors *errors, long row, int field, int width) {
+    if (errors == NULL) {
         return;
     }
-    fread_with_check(page, sizeof(Page), 1, file);
-    page->data = malloc(page_size);
-    char *slot_info = (char *) malloc(fixed_len_page_capacity(page) * sizeof(char));
-
-    fread_with_check(slot_info, fixed_len_page_capacity(page) * sizeof(char), 1, file);
-    fread_with_check(page->data, page_size, 1, file);
-
-    page->slot_info = new ByteArray;
-    read_bytes(slot_info, fixed_len_page_capacity(page) * sizeof(char), page->slot_info);
+    if (errors->first.size() < CSV_MAX_REPORTED_ERRORS) {
+        CsvError error = {row, field, width};
+        errors->first.push_back(error);
+    }
+    errors->count++;
 }
 
 /**
- * Write a page from memory to disk
+ * Copy field [begin, end) of the current row into row. The common case,
+ * an unquoted field of exactly ATTRIBUTE_SIZE bytes, is a single memcpy.
  */
-void write_page(Page *page, Heapfile *heapfile, PageID pid) {
-    int page_size = heapfile->page_size;
-    FILE *file = heapfile->file_ptr;
-
-    if (reach_page(heapfile, pid) == -1) {
-        page->data = NULL;
+static void store_csv_field(const char *begin, const char *end, bool quoted, int field,
+                            char *row, long row_id, CsvErrors *errors) {
+    if (field >= ATTR_PER_RECORD) {
+        return;
+    }
+    char *dest = row + field * ATTRIBUTE_SIZE;
+    if (!quoted && end - begin == ATTRIBUTE_SIZE) {
+        memcpy(dest, begin, ATTRIBUTE_SIZE);
         return;
     }
-    char *slot_info = (char *) malloc(fixed_len_page_capacity(page) * sizeof(char));
-    write_bytes(page->slot_info, slot_info);
 
-    fwrite_with_check(page, sizeof(Page), 1, file);
-    fwrite_with_check(slot_info, fixed_len_page_capacity(page) * sizeof(char), 1, file);
-    fwrite_with_check(page->data, page_size, 1, file);
+    int width = 0;
+    for (const char *p = begin; p < end; p++) {
+        if (*p != '"') {
+            if (width < ATTRIBUTE_SIZE) {
+                dest[width] = *p;
+            }
+            width++;
+        }
+    }
+    if (width != ATTRIBUTE_SIZE) {
+        add_csv_error(errors, row_id, field, width);
+    }
+}
+
+int tokenize_csv(const char *begin, const char *end, vector<char> *rows, CsvErrors *errors) {
+    int num_rows = 0;
+    size_t row_offset = 0;
+    bool in_row = false;
+    const char *field_start = begin;
+    int field = 0;
+    bool quoted = false;
+
+    char tail[64];
+    const char *block = begin;
+    while (block < end) {
+        // Delimiters of the next 64 bytes; a short last block is padded.
+        uint64_t mask;
+        if (end - block >= 64) {
+            mask = csv_delimiters(block);
+        } else {
+            memset(tail, 0, 64);
+            memcpy(tail, block, end - block);
+            mask = csv_delimiters(tail);
+        }
+
+        // One extra pass for the end of input acts as a final newline.
+        bool last = end - block <= 64;
+        while (mask != 0 || last) {
+            const char *delim;
+            if (mask != 0) {
+                delim = block + __builtin_ctzll(mask);
+                mask &= mask - 1;
+            } else {
+                delim = end;
+                last = false;
+            }
+            bool eol = delim == end || *delim == '\n';
+            if (delim != end && *delim == '"') {
+                quoted = true;
+                continue;
+            }
+
+            const char *field_end = delim;
+            if (eol && field_end > field_start && field_end[-1] == '\r') {
+                field_end--;
+            }
+            if (!in_row && eol && field == 0 && field_end == field_start) {
+                // Blank line.
+                field_start = delim + 1;
+                quoted = false;
+                continue;
+            }
+            if (!in_row) {
+                row_offset = (size_t) num_rows * SLOT_SIZE;
+                if (row_offset + SLOT_SIZE > rows->size()) {
+                    rows->resize(max(rows->size() * 2, (size_t) 64 * SLOT_SIZE));
+                }
+                // Short or missing fields are padded with spaces, as update stores them.
+                memset(rows->data() + row_offset, ' ', SLOT_SIZE);
+                in_row = true;
+            }
+            store_csv_field(field_start, field_end, quoted, field, rows->data() + row_offset, num_rows, errors);
+
+            field_start = delim + 1;
+            quoted = false;
+            field++;
+            if (eol) {
+                if (field != ATTR_PER_RECORD) {
+                    add_csv_error(errors, num_rows, -1, field);
+                }
+                num_rows++;
+                in_row = false;
+                field = 0;
+            }
+        }
+        block += 64;
+    }
+    return num_rows;
 }
 
 /**
- * Read lines in file into page. Return when page is full.
+ * Tokenize the CSV chunk [begin, end) into rows.
  */
-int read_csv2page(ifstream *file, Page *page) {
-    int free_space = fixed_len_page_freeslots(page);
-    char chars_to_remove[] = ",\"";
-    string line;
-    int numRecs = 0;
+static void parse_csv_chunk(const char *begin, const char *end, vector<char> *rows, int *num_rows,
+                            CsvErrors *errors) {
+    errors->count = 0;
+    errors->first.clear();
+    *num_rows = tokenize_csv(begin, end, rows, errors);
+}
 
-    for(;free_space > 0 && getline(*file, line); free_space--) {
-        for (int i = 0; i < strlen(chars_to_remove); ++i) {
-            line.erase(remove(line.begin(), line.end(), chars_to_remove[i]), line.end());
+static void report_csv_errors(CsvErrors *errors, long first_row, long *reported) {
+    for (int i = 0; i < errors->first.size() && *reported < CSV_MAX_REPORTED_ERRORS; i++, (*reported)++) {
+        CsvError *error = &errors->first[i];
+        if (error->field == -1) {
+            fprintf(stderr, "row %ld: %d fields, expected %d\n",
+                    first_row + error->row + 1, error->width, ATTR_PER_RECORD);
+        } else {
+            fprintf(stderr, "row %ld: field %d is %d bytes wide, expected %d\n",
+                    first_row + error->row + 1, error->field, error->width, ATTRIBUTE_SIZE);
         }
-        Record *record = new Record;
-        fixed_len_read((void *) line.c_str(), SLOT_SIZE, record);
+    }
+}
 
-        add_fixed_len_page(page, record);
-        numRecs++;
+long parallel_load_csv(const char *csv_file, int num_threads, RowsCallback callback, void *arg) {
+    assert(num_threads > 0);
+
+    int fd = open(csv_file, O_RDONLY);
+    if (fd == -1) {
+        return -1;
     }
-    return numRecs;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *data = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    // Each round parses num_threads chunks, so memory stays bounded by the
+    // chunk size no matter how large the file is.
+    vector<vector<char> > rows(num_threads);
+    vector<int> num_rows(num_threads);
+    vector<CsvErrors> errors(num_threads);
+    long total = 0;
+    long num_errors = 0;
+    long reported = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        vector<thread> workers;
+        for (int i = 0; i < num_threads && pos < size; i++) {
+            size_t end = pos + CSV_CHUNK_SIZE;
+            if (end >= size) {
+                end = size;
+            } else {
+                const char *eol = (const char *) memchr(data + end, '\n', size - end);
+                end = eol == NULL ? size : eol - data + 1;
+            }
+            workers.push_back(thread(parse_csv_chunk, data + pos, data + end, &rows[i], &num_rows[i], &errors[i]));
+            pos = end;
+        }
+        // Hand out chunk i while the later ones are still being parsed.
+        for (int i = 0; i < workers.size(); i++) {
+            workers[i].join();
+            callback(rows[i].data(), num_rows[i], arg);
+            report_csv_errors(&errors[i], total, &reported);
+            num_errors += errors[i].count;
+            total += num_rows[i];
+        }
+    }
+    if (num_errors > 0) {
+        fprintf(stderr, "%ld malformed fields or rows in %s\n", num_errors, csv_file);
+    }
+
+    munmap((void *) data, size);
+    return total;
 }
 
 /**
@@ -296,45 +3857,120 @@ void read_attr(Record *record, int attr_id, void *buf) {
     record->at(attr_id) = value;
 }
 
-RecordIterator::RecordIterator(Heapfile *hFile) {
+RecordIterator::RecordIterator(Heapfile *hFile, int read_ahead, const vector<PageID> *pages) {
     page_size = hFile->page_size;
     heapfile = hFile;
+    this->read_ahead = read_ahead;
+    this->pages = pages;
+    page_index = 0;
+    prefetched = 0;
 
     cur_rid = (RecordID*) malloc(sizeof(RecordID));
-    cur_rid->page_id = 1;
+    cur_rid->page_id = page_at(0);
     cur_rid->slot = 0;
     has_next = true;
+    prev_pid = -1;
 
-    cur_page = new Page;
-    read_page(hFile, cur_rid->page_id, cur_page);
+    cur_page = NULL;
+    if (cur_rid->page_id != -1) {
+        prefetch();
+        cur_page = pin_page(heapfile, cur_rid->page_id);
+    }
 
-    if (heapfile->number_of_page > 0) {
+    if (cur_page != NULL) {
         find_next();
     } else {
         has_next = false;
     }
 }
 
-Record RecordIterator::next() {
-    Record *record = new Record();;
-    read_fixed_len_page(cur_page, cur_rid->slot, record);
+RecordIterator::~RecordIterator() {
+    release_prev();
+    if (cur_page != NULL) {
+        unpin_page(heapfile, cur_rid->page_id, false);
+    }
+    free(cur_rid);
+}
+
+Record RecordIterator::next(Arena *arena) {
+    release_prev();
+
+    Record record;
+    read_fixed_len_page(cur_page, cur_rid->slot, &record, arena);
+    cur_rid->slot++;
+
+    if (cur_rid->slot >= fixed_len_page_capacity(cur_page)) {
+        if (!next_page()) {
+            return record;
+        }
+    }
+    find_next();
+
+    return record;
+}
+
+/**
+ * Return a view of the next record. The view points into the buffered page
+ * and stays valid until the following call to next or next_view.
+ */
+RecordView RecordIterator::next_view() {
+    release_prev();
+
+    RecordView view;
+    read_fixed_len_page_view(cur_page, cur_rid->slot, &view);
     cur_rid->slot++;
 
     if (cur_rid->slot >= fixed_len_page_capacity(cur_page)) {
-        cur_rid->page_id++;
-        cur_rid->slot = 0;
-        if (cur_rid->page_id > heapfile->number_of_page) {
-            has_next = false;
-            return *record;
+        if (!next_page()) {
+            return view;
+        }
+    }
+    find_next();
+
+    return view;
+}
+
+/**
+ * Fill batch with up to max records, all taken from the current page.
+ * Returns the number of records, 0 once the iterator is exhausted.
+ */
+int RecordIterator::next_batch(RecordBatch *batch, int max) {
+    release_prev();
+
+    batch->size = 0;
+    batch->slots.clear();
+    if (!has_next) {
+        return 0;
+    }
+    batch->page = cur_page;
+    batch->page_id = cur_rid->page_id;
+
+    int capacity = fixed_len_page_capacity(cur_page);
+    int slot = cur_rid->slot;
+    while (slot < capacity && batch->size < max) {
+        uint64_t word = cur_page->slot_bitmap[slot / 64] >> (slot % 64);
+        if (word == 0) {
+            slot = (slot / 64 + 1) * 64;
+            continue;
         }
-        free(cur_page->data);
-        cur_page = new Page;
+        slot += __builtin_ctzll(word);
+        if (slot >= capacity) {
+            break;
+        }
+        batch->slots.push_back(slot);
+        batch->size++;
+        slot++;
+    }
 
-        read_page(heapfile, cur_rid->page_id, cur_page);
+    cur_rid->slot = slot;
+    if (cur_rid->slot >= capacity) {
+        if (!next_page()) {
+            return batch->size;
+        }
     }
     find_next();
 
-    return *record;
+    return batch->size;
 }
 
 bool RecordIterator::hasNext() {
@@ -342,73 +3978,137 @@ bool RecordIterator::hasNext() {
 }
 
 void RecordIterator::find_next() {
-    while (cur_page->slot_info->at(cur_rid->slot) == '0') {
-        cur_rid->slot++;
-        if (cur_rid->slot >= fixed_len_page_capacity(cur_page)) {
-            cur_rid->page_id++;
-            cur_rid->slot = 0;
-            if (cur_rid->page_id > heapfile->number_of_page) {
-                has_next = false;
+    // Skip free slots a bitmap word at a time.
+    while (1) {
+        int capacity = fixed_len_page_capacity(cur_page);
+        int slot = cur_rid->slot;
+        while (slot < capacity) {
+            uint64_t word = cur_page->slot_bitmap[slot / 64] >> (slot % 64);
+            if (word != 0) {
+                slot += __builtin_ctzll(word);
                 break;
             }
+            slot = (slot / 64 + 1) * 64;
+        }
 
-            free(cur_page->data);
-            cur_page = new Page;
-
-            read_page(heapfile, cur_rid->page_id, cur_page);
+        if (slot < capacity) {
+            cur_rid->slot = slot;
+            return;
+        }
+        if (!next_page()) {
+            return;
         }
     }
 }
 
-int reach_page(Heapfile *heapfile, PageID pid) {
-    int page_size = heapfile->page_size;
-    FILE *file = heapfile->file_ptr;
+/**
+ * Unpin the current page and pin the following one.
+ * Returns false once the last page has been consumed.
+ */
+bool RecordIterator::next_page() {
+    // Keep the page the last record came from pinned for its view; pages
+    // skipped by find_next have no views and are released right away.
+    if (prev_pid == -1) {
+        prev_pid = cur_rid->page_id;
+    } else {
+        unpin_page(heapfile, cur_rid->page_id, false);
+    }
+    cur_page = NULL;
 
-    int number_of_pages_per_dir = get_number_of_pages(page_size);
-    int nth_dir = (pid - 1) / number_of_pages_per_dir;
-    int order_in_dir = (pid - 1) % number_of_pages_per_dir;
+    page_index++;
+    cur_rid->page_id = page_at(page_index);
+    cur_rid->slot = 0;
+    if (cur_rid->page_id == -1) {
+        has_next = false;
+        return false;
+    }
 
-    fseek(file, sizeof(Heapfile), SEEK_SET);
+    prefetch();
+    cur_page = pin_page(heapfile, cur_rid->page_id);
+    if (cur_page == NULL) {
+        has_next = false;
+        return false;
+    }
+    return true;
+}
 
-    for (int i = 0; i < nth_dir; i++) {
-        fseek(file, sizeof(Page), SEEK_CUR);
-        uint32_t next_dir_offset = read_offset(file);
-        if (next_dir_offset == 0) {
-            return -1;
+/**
+ * Keep up to read_ahead pages past the current one requested from disk.
+ * The window is refilled once half of it has been consumed so the kernel
+ * sees large sequential requests rather than one per page.
+ */
+void RecordIterator::prefetch() {
+    if (read_ahead <= 0 || page_at(prefetched) == -1) {
+        return;
+    }
+    if (prefetched - (page_index + 1) >= read_ahead / 2) {
+        return;
+    }
+    // Consecutive pages are requested together.
+    int last = page_index + 1 + read_ahead;
+    while (prefetched < last && page_at(prefetched) != -1) {
+        PageID first = page_at(prefetched);
+        PageID end = first;
+        prefetched++;
+        while (prefetched < last && page_at(prefetched) == end + 1) {
+            end++;
+            prefetched++;
         }
-        fseek(file, next_dir_offset, SEEK_SET);
+        prefetch_pages(heapfile, first, end);
     }
-    fseek(file, sizeof(Page) + OFFSET_SIZE, SEEK_CUR);
-    fseek(file, order_in_dir * get_entry_size(page_size), SEEK_CUR);
-    uint32_t offset = read_offset(file);
+}
 
-    if (offset != 0) {
-        fseek(file, offset, SEEK_SET);
-    } else {
+/**
+ * Page at position index among the pages to visit, or -1 past the last.
+ */
+PageID RecordIterator::page_at(int index) {
+    if (pages != NULL) {
+        return (index < pages->size()) ? pages->at(index) : -1;
+    }
+    return (index < heapfile->number_of_page) ? index + 1 : -1;
+}
+
+void RecordIterator::release_prev() {
+    if (prev_pid != -1) {
+        unpin_page(heapfile, prev_pid, false);
+        prev_pid = -1;
+    }
+}
+
+/**
+ * Seek the heapfile to the start of page pid using the in-memory directory.
+ * Returns -1 if the page does not exist.
+ */
+int reach_page(Heapfile *heapfile, PageID pid) {
+    if (pid < 1 || pid > heapfile->page_offsets->size()) {
+        return -1;
+    }
+    uint32_t offset = heapfile->page_offsets->at(pid - 1);
+    if (offset == 0) {
         return -1;
     }
+    fseek(heapfile->file_ptr, offset, SEEK_SET);
     return 0;
 }
 
-uint32_t alloc_page_at_end(FILE *file, int page_size, bool dir_page) {
+uint32_t alloc_page_at_end(FILE *file, int page_size, int slot_size, bool dir_page) {
     uint32_t current = ftell(file);
     fseek (file, 0, SEEK_END);
     uint32_t offset = ftell(file);
     Page *new_page = new Page();
-    init_fixed_len_page(new_page, page_size, SLOT_SIZE);
+    init_fixed_len_page(new_page, page_size, slot_size);
+    memset(new_page->data, 0, page_size);
 
     if (!dir_page) {
-        char *slot_info = (char *) malloc(fixed_len_page_capacity(new_page) * sizeof(char));
-        write_bytes(new_page->slot_info, slot_info);
-
         fwrite_with_check(new_page, sizeof(Page), 1, file);
-        fwrite_with_check(slot_info, fixed_len_page_capacity(new_page) * sizeof(char), 1, file);
+        fwrite_with_check(new_page->slot_bitmap, slot_bitmap_size(new_page), 1, file);
         fwrite_with_check(new_page->data, page_size, 1, file);
     } else {
         fwrite(new_page, sizeof(Page), 1, file);
         fwrite(new_page->data, page_size, 1, file);
     }
     free(new_page->data);
+    free(new_page->slot_bitmap);
     fseek(file, current, SEEK_SET);
 
     return offset;
@@ -442,32 +4142,37 @@ int get_number_of_pages(int page_size) {
     return (page_size - OFFSET_SIZE) / get_entry_size(page_size);
 }
 
-uint32_t read_offset(FILE *file) {
-    uint32_t *buffer = (uint32_t *) malloc(OFFSET_SIZE);
-    if (buffer == NULL) {
-        fputs("Memory error\n", stderr); 
-        exit(2);
-    }
-
-    if (fread_with_check(buffer, OFFSET_SIZE, 1, file) != 1) {
-        free(buffer);
-        return 0;
-    }
+int slot_bitmap_words(int num_slots) {
+    return (num_slots + 63) / 64;
+}
 
-    int result = *buffer;
-    free(buffer);
+int slot_bitmap_size(Page *page) {
+    return (fixed_len_page_capacity(page) + 7) / 8;
+}
 
-    return result;
+bool slot_is_used(Page *page, int slot) {
+    return (page->slot_bitmap[slot / 64] >> (slot % 64)) & 1;
 }
 
-void read_bytes(void *buf, int numSlots, ByteArray *slot_info) {
-    for (int i = 0; i < numSlots; i++) {
-        slot_info->push_back(*((char *) buf + i));
+void set_slot_used(Page *page, int slot, bool used) {
+    if (used) {
+        page->slot_bitmap[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    } else {
+        page->slot_bitmap[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
     }
 }
 
-void write_bytes(ByteArray *slot_info, void *buf) {
-    for (int i = 0; i < slot_info->size(); i++) {
-        *((char*) buf + i) = slot_info->at(i);
+/**
+ * Find the first free slot of the page, or -1 if the page is full.
+ */
+int find_free_slot(Page *page) {
+    int num_slots = fixed_len_page_capacity(page);
+    for (int w = 0; w < slot_bitmap_words(num_slots); w++) {
+        uint64_t free_bits = ~page->slot_bitmap[w];
+        if (free_bits != 0) {
+            int slot = w * 64 + __builtin_ctzll(free_bits);
+            return slot < num_slots ? slot : -1;
+        }
     }
+    return -1;
 }
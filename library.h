@@ -2,9 +2,12 @@
 #define LIBRARY_H
 
 #include <vector>
+#include <string>
 #include <cstring>
+#include <cstddef>
 #include <stdio.h>
 #include <stdint.h>
+#include <atomic>
 
 using namespace std;
 
@@ -16,26 +19,397 @@ using namespace std;
 typedef const char* V;
 typedef vector<V> Record;
 typedef int PageID;
-typedef vector<char> ByteArray;
 
 typedef struct {
     void *data;
     int page_size;
     int slot_size;
-    ByteArray *slot_info; //byte array to store info about slots: 0 if free 1 if not
+    uint64_t *slot_bitmap; //bit i is set if slot i is used; stored as slot_bitmap_size bytes
 } Page;
 
+#define FSM_BUCKETS 8
+
+/**
+ * Free space map: pages with free slots are kept in buckets by how much
+ * room they have, so a page with room is found without reading any page.
+ */
+typedef struct {
+    vector<int> free_space;   // free bytes of each page, by pid - 1, as in the directory
+    vector<PageID> buckets[FSM_BUCKETS];
+    vector<int> bucket_of;    // bucket holding each page, -1 if the page is full
+    vector<int> position;     // index of each page within its bucket
+} FreeSpaceMap;
+
+struct BTree;
+struct HashIndex;
+
+#define ZONE_MAP_SUFFIX ".zm"
+#define ZONE_MAP_BLOCK_PAGES 64
+
+/**
+ * Smallest and largest value of one attribute over the used slots of a
+ * page. A page without records has min > max.
+ */
+typedef struct {
+    char min[ATTRIBUTE_SIZE];
+    char max[ATTRIBUTE_SIZE];
+} Zone;
+
+/**
+ * Sidecar file of a heapfile with a Zone per page for some of its
+ * attributes. Zones are stored in blocks of ZONE_MAP_BLOCK_PAGES pages,
+ * attribute by attribute, so a query reads only the zones of its
+ * attribute. The block being updated is kept in memory until another
+ * block is needed.
+ */
+typedef struct {
+    FILE *file_ptr;
+    vector<int> *attrs;          // attributes with zones, in file order
+    int column[ATTR_PER_RECORD]; // index of each attribute in attrs, -1 if it has no zones
+    vector<Zone> *block;         // attrs->size() * ZONE_MAP_BLOCK_PAGES zones
+    int block_id;                // -1 if no block is loaded
+    bool dirty;
+} ZoneMap;
+
+#define BLOOM_SUFFIX ".bf"
+#define BLOOM_BITS_PER_VALUE 10
+#define BLOOM_HASHES 7
+
+/**
+ * Bloom filters of each page of a heapfile or column store on some of its
+ * attributes, words 64-bit words each. They are kept in memory and the
+ * sidecar file is rewritten whole when they changed.
+ */
+typedef struct {
+    FILE *file_ptr; // NULL until written
+    int words;
+    bool dirty;
+    vector<uint64_t> *filters[ATTR_PER_RECORD]; // filter of page i at i * words, NULL if none
+} BloomFilters;
+
 typedef struct {
     FILE *file_ptr;
     int page_size;
     uint32_t number_of_page;
+    // In-memory copy of the directory, loaded once by open_heapfile.
+    vector<uint32_t> *dir_offsets;  // file offset of each directory page
+    vector<uint32_t> *page_offsets; // file offset of each data page, by pid - 1
+    int slot_size;                  // slot size of pages created by alloc_page
+    FreeSpaceMap *free_space_map;
+    ZoneMap *zone_map;              // NULL if the heapfile has no zone map
+    BloomFilters *bloom;            // NULL if no attribute has Bloom filters
+    vector<BTree *> *indexes;       // indexes kept up to date by update_indexes
+    vector<HashIndex *> *hash_indexes;
 } Heapfile;
+
+// Only the fields before the in-memory directory are stored in the file header.
+#define HEAPFILE_HEADER_SIZE offsetof(Heapfile, dir_offsets)
  
 typedef struct {
     int page_id;
     int slot;
 } RecordID;
 
+/**
+ * One operation of a batch: delete record rid, or set its attribute
+ * attr_id to value.
+ */
+typedef struct {
+    RecordID rid;
+    int attr_id;                // -1 for a delete
+    char value[ATTRIBUTE_SIZE]; // padded with spaces
+} RecordOp;
+
+#define INDEX_SUFFIX ".idx"
+#define BTREE_NODE_SIZE 4096
+#define BTREE_FILL_PERCENT 90 // how full build_index packs the leaves
+
+/**
+ * Entry of a B+ tree index. Entries are ordered by value, then by record,
+ * so every entry is unique even when values repeat.
+ */
+typedef struct {
+    char value[ATTRIBUTE_SIZE];
+    RecordID rid;
+} IndexEntry;
+
+/**
+ * Disk-resident B+ tree over one attribute of a heapfile, stored in
+ * BTREE_NODE_SIZE-byte nodes. Node 0 holds the header; leaves hold
+ * IndexEntry arrays and are chained in key order for range scans.
+ */
+struct BTree {
+    FILE *file_ptr;
+    int attr_id;
+    uint32_t root;
+    uint32_t num_nodes;   // nodes in the file, the header included
+    uint32_t height;      // 1 while the root is a leaf
+    uint64_t num_entries;
+};
+
+#define HASH_INDEX_SUFFIX ".hash"
+#define HASH_PAGE_SIZE 4096
+#define HASH_MAX_DEPTH 20     // deepest directory before buckets only overflow
+#define HASH_FILL_PERCENT 70  // how full build_hash_index packs the buckets
+
+/**
+ * Disk-resident extendible hash index over one attribute of a heapfile,
+ * stored in HASH_PAGE_SIZE-byte pages. Page 0 holds the header. The low
+ * global_depth bits of the hash of a value select a directory slot that
+ * holds the page of its bucket. A bucket holds IndexEntry arrays and
+ * chains overflow pages for values too frequent to be split apart.
+ */
+struct HashIndex {
+    FILE *file_ptr;
+    int attr_id;
+    uint32_t global_depth;
+    uint32_t dir_page;    // first page of the directory
+    uint32_t num_pages;   // pages in the file, the header included
+    uint64_t num_entries;
+    uint32_t free_page;   // first page of the free list, 0 if it is empty
+};
+
+/**
+ * Non-owning views into page memory. A view is only valid while the page
+ * it points into stays pinned; attributes are not NUL-terminated.
+ */
+typedef struct {
+    const char *data;
+    int len;
+} AttrView;
+
+typedef struct {
+    const char *data;
+    int len;
+} RecordView;
+
+#define RECORD_BATCH_SIZE 1024
+
+/**
+ * Rows returned by RecordIterator::next_batch: occupied slots of one page.
+ * The page stays pinned until the next call on the iterator.
+ */
+typedef struct {
+    PageID page_id;
+    Page *page;
+    int size;          // number of rows in the batch
+    vector<int> slots; // selection vector: slot of each row
+} RecordBatch;
+
+#define DEFAULT_MORSEL_PAGES 16
+
+#define DEFAULT_READ_AHEAD_PAGES 32
+
+#define CSV_CHUNK_SIZE (16 << 20)
+
+/**
+ * Called by parallel_load_csv, in file order, with num_rows parsed rows of
+ * SLOT_SIZE bytes each.
+ */
+typedef void (*RowsCallback)(char *rows, int num_rows, void *arg);
+
+#define CSV_MAX_REPORTED_ERRORS 10
+
+/**
+ * Bounded lock-free queue of pointers from one producer thread to one
+ * consumer thread. The capacity is a power of two.
+ */
+typedef struct {
+    void **slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head; // next slot to pop, advanced by the consumer
+    alignas(64) atomic<size_t> tail; // next slot to push, advanced by the producer
+} SpscRing;
+
+/**
+ * A malformed row of a CSV file. field is the field whose width, with
+ * quotes removed, is not ATTRIBUTE_SIZE, or -1 if the row has width
+ * fields instead of ATTR_PER_RECORD.
+ */
+typedef struct {
+    long row;
+    int field;
+    int width;
+} CsvError;
+
+typedef struct {
+    long count;
+    vector<CsvError> first; // the first CSV_MAX_REPORTED_ERRORS errors
+} CsvErrors;
+
+/**
+ * Called by parallel_scan for every page, read into a buffer private to the
+ * calling worker. Output for the page is appended to out. Returns the
+ * number of records the callback produced.
+ */
+typedef int (*PageCallback)(Page *page, PageID pid, string *out, void *arg);
+
+#define DEFAULT_ARENA_BLOCK_SIZE (1 << 20)
+
+/**
+ * Bump allocator owned by a query or load. Memory handed out by
+ * arena_alloc is only released in bulk by reset_arena/free_arena.
+ */
+typedef struct {
+    vector<char *> *blocks; // blocks of block_size bytes, reused after a reset
+    vector<char *> *large;  // allocations bigger than a block, freed on reset
+    size_t block_size;
+    int cur_block;
+    size_t used;            // bytes used in the current block
+} Arena;
+
+#define BULK_LOAD_BUFFER_SIZE (4 << 20)
+
+/**
+ * Appends pages to an empty heapfile without alloc_page or the buffer pool.
+ * Data pages and placeholder directory pages are staged in buf and written
+ * sequentially; the directory and header are written once at the end.
+ */
+typedef struct {
+    Heapfile *heapfile;
+    char *buf;
+    size_t buf_size;
+    size_t used;
+    vector<char *> *dirs; // contents of every directory page
+} BulkLoader;
+
+#define COLSTORE_MAGIC 0x34545343 // "CST4"
+#define COLSTORE_ROW_GROUP_SIZE (16 << 20)
+
+/*
+ * Column page encodings, chosen per page at load time. The first byte of
+ * a column page on disk is its encoding.
+ *   PLAIN:  the values, ATTRIBUTE_SIZE bytes each.
+ *   DICT:   sorted distinct values and a bit-packed code per value.
+ *   RLE:    the value of every run and the row after each run.
+ *   PACKED: each value as 5 bits per character ('a'-'z', or NUL), which
+ *           keeps the order of the values.
+ */
+#define ENCODING_PLAIN 0
+#define ENCODING_DICT 1
+#define ENCODING_RLE 2
+#define ENCODING_PACKED 3
+#define NUM_ENCODINGS 4
+
+/**
+ * Location of one page of a column chunk. A column page holds up to
+ * page_size / ATTRIBUTE_SIZE values; every page of a chunk is full except
+ * the last.
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t size;       // bytes on disk
+    uint32_t num_values;
+    char min[ATTRIBUTE_SIZE]; // smallest and largest value of the page
+    char max[ATTRIBUTE_SIZE];
+} ColumnPageInfo;
+
+/**
+ * A horizontal slice of the table. Its column chunks are stored one after
+ * the other, so the values of a row are close together on disk.
+ */
+typedef struct {
+    uint64_t first_row;
+    uint32_t num_rows;
+    vector<vector<ColumnPageInfo> > chunks; // pages of each attribute
+} RowGroup;
+
+/**
+ * Single-file column store: row groups followed by a footer that indexes
+ * every column page, then the footer offset (8 bytes) and COLSTORE_MAGIC.
+ * A sorted projection stores its rows in order of attribute sort_attr.
+ */
+typedef struct {
+    FILE *file_ptr;
+    int page_size;
+    int sort_attr;     // -1 if rows are in arrival order
+    uint64_t num_rows;
+    vector<RowGroup> *row_groups;
+} Colstore;
+
+/**
+ * Writes a column store. Rows are transposed into one buffer per column
+ * and each full row group is written with one sequential write per chunk.
+ */
+typedef struct {
+    FILE *file_ptr;
+    int page_size;
+    int sort_attr;     // attribute the rows are appended in order of, or -1
+    int rows_per_group;
+    char *values;      // ATTR_PER_RECORD chunks of rows_per_group values
+    int cursor;        // rows in the current row group
+    uint64_t offset;   // where the next chunk is written
+    vector<RowGroup> *row_groups;
+    char *page_buf;    // encoded page being written
+    long encoded_pages[NUM_ENCODINGS];
+    uint64_t plain_bytes; // size of the values before encoding
+    BloomFilters *bloom;  // filled with the values of each page, or NULL
+} ColstoreWriter;
+
+/**
+ * A column page read from disk, still encoded. The pointers refer to the
+ * buffer it was parsed from.
+ */
+typedef struct {
+    int encoding;
+    int num_values;
+    const char *values;   // PLAIN values, DICT dictionary or RLE run values
+    int num_entries;      // DICT dictionary entries or RLE runs
+    const char *run_ends; // RLE: uint32 row after each run
+    const char *packed;   // DICT codes or PACKED values
+    int bits;             // bits per packed code or value
+} EncodedPage;
+
+#define BITMAP_INDEX_SUFFIX ".bm"
+#define BITMAP_MAX_PREFIX 2
+
+enum {
+    CONTAINER_ARRAY,  // sorted low 16 bits of each row
+    CONTAINER_BITSET, // 4096 words, bit i set for row i
+    CONTAINER_RUNS    // (first, length - 1) pairs
+};
+
+/**
+ * The rows of a bitmap that share their high 16 bits, stored in whichever
+ * container type takes the fewest words.
+ */
+typedef struct {
+    uint16_t key;
+    uint16_t type;
+    vector<uint16_t> data;
+} BitmapContainer;
+
+/**
+ * Roaring-style compressed set of row numbers: containers by increasing key.
+ */
+typedef vector<BitmapContainer> Bitmap;
+
+/**
+ * Bitmap index on the first prefix_len bytes of an attribute of a column
+ * store: one bitmap of rows per distinct prefix.
+ */
+typedef struct {
+    int attr_id;
+    int prefix_len;
+    uint64_t num_rows;
+    vector<string> *prefixes; // in increasing order
+    vector<Bitmap> *bitmaps;  // rows of each prefix
+} BitmapIndex;
+
+/**
+ * Called by parallel_scan_column for every page of the column.
+ */
+typedef int (*ColumnPageCallback)(EncodedPage *page, string *out, void *arg);
+
+#define DEFAULT_BUFFER_POOL_FRAMES 64
+
+typedef struct {
+    long hits;
+    long misses;
+    long evictions;
+    long write_backs;
+} BufferPoolStats;
+
 /**
  * Compute the number of bytes required to serialize record
  */
@@ -48,9 +422,10 @@ void fixed_len_write(Record *record, void *buf);
 
 /**
  * Deserializes `size` bytes from the buffer, `buf`, and
- * stores the record in `record`.
+ * stores the record in `record`. Attributes are allocated from arena
+ * when one is given, otherwise each one is malloc'ed.
  */
-void fixed_len_read(void *buf, int size, Record *record);
+void fixed_len_read(void *buf, int size, Record *record, Arena *arena = NULL);
 
 /**
  * Initializes a page using the given slot size
@@ -75,6 +450,12 @@ int fixed_len_page_freeslots(Page *page);
  */
 int add_fixed_len_page(Page *page, Record *r);
  
+/**
+ * Copy slot_size bytes from buf into a free slot of the page.
+ * Returns the slot, or -1 if the page is full.
+ */
+int add_fixed_len_slot(Page *page, const void *buf);
+
 /**
  * Write a record into a given slot.
  */
@@ -83,7 +464,115 @@ void write_fixed_len_page(Page *page, int slot, Record *r);
 /**
  * Read a record from the page from a given slot.
  */
-void read_fixed_len_page(Page *page, int slot, Record *r);
+void read_fixed_len_page(Page *page, int slot, Record *r, Arena *arena = NULL);
+
+/**
+ * Point view at the record in the given slot without copying it.
+ * Returns false if the slot is empty.
+ */
+bool read_fixed_len_page_view(Page *page, int slot, RecordView *view);
+
+/**
+ * Number of attributes in the viewed record.
+ */
+int record_view_size(RecordView *view);
+
+/**
+ * View of attribute attr_id of the viewed record.
+ */
+AttrView record_view_attr(RecordView *view, int attr_id);
+
+/**
+ * Compare an attribute with a NUL-terminated value, like strcmp(attr, value).
+ */
+int compare_attr(AttrView attr, const char *value);
+
+/**
+ * View of row i of the batch.
+ */
+RecordView batch_row(RecordBatch *batch, int i);
+
+/**
+ * Scan every page of the heapfile with num_threads workers. Pages are handed
+ * out in morsels of morsel_size consecutive pages and read with pread, so
+ * the workers never share a file position. The output of each morsel is
+ * written to out in page order if ordered, otherwise as soon as it is ready.
+ * Only the given pages are scanned when pages is not NULL.
+ * Returns the total returned by callback.
+ */
+long parallel_scan(Heapfile *heapfile, int num_threads, int morsel_size, bool ordered,
+                   PageCallback callback, void *arg, FILE *out, const vector<PageID> *pages = NULL);
+
+/**
+ * parallel_scan over the pages of column attr of a column store, in row
+ * order. When start is given, pages that column_page_may_match rules out
+ * are skipped, and for an equality on whole values so are pages that bloom
+ * rules out.
+ */
+long parallel_scan_column(Colstore *colstore, int attr, int num_threads, int morsel_size, bool ordered,
+                          ColumnPageCallback callback, void *arg, FILE *out,
+                          const char *start = NULL, const char *end = NULL, int len = 0,
+                          BloomFilters *bloom = NULL);
+
+/**
+ * Wall-clock milliseconds, for timing runs that use several threads.
+ */
+long wall_clock_msec();
+
+/**
+ * Range predicate kernels over count consecutive ATTRIBUTE_SIZE-byte values.
+ * Bit i of match (ceil(count / 64) words) is set when the first len bytes
+ * of value i satisfy memcmp(start, value, len) <= 0 && memcmp(end, value, len) >= 0.
+ * range_match picks the fastest kernel supported by the CPU at runtime.
+ */
+void range_match(const char *values, int count, const char *start, const char *end, int len, uint64_t *match);
+
+void range_match_scalar(const char *values, int count, const char *start, const char *end, int len, uint64_t *match);
+
+void range_match_sse2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match);
+
+void range_match_avx2(const char *values, int count, const char *start, const char *end, int len, uint64_t *match);
+
+bool cpu_has_avx2();
+
+/**
+ * Initialize an empty ring holding up to capacity pointers, rounded up to
+ * a power of two.
+ */
+void init_ring(SpscRing *ring, size_t capacity);
+
+/**
+ * Producer side. Returns false if the ring is full.
+ */
+bool ring_push(SpscRing *ring, void *item);
+
+/**
+ * Consumer side. Returns false if the ring is empty.
+ */
+bool ring_pop(SpscRing *ring, void **item);
+
+void free_ring(SpscRing *ring);
+
+/**
+ * Initialize an empty arena that grows in blocks of block_size bytes.
+ */
+void init_arena(Arena *arena, size_t block_size);
+
+/**
+ * Allocate size bytes from the arena.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Release everything allocated from the arena at once, keeping its
+ * blocks for reuse.
+ */
+void reset_arena(Arena *arena);
+
+/**
+ * Return all memory held by the arena.
+ */
+void free_arena(Arena *arena);
 
 /**
  * Initalize a heapfile to use the file and page size given.
@@ -95,6 +584,159 @@ void init_heapfile(Heapfile *heapfile, int page_size, FILE *file);
  */
 PageID alloc_page(Heapfile *heapfile);
 
+/**
+ * Start bulk loading into heapfile, which must have no pages yet.
+ */
+void init_bulk_load(BulkLoader *loader, Heapfile *heapfile, size_t buffer_size = BULK_LOAD_BUFFER_SIZE);
+
+/**
+ * Append a copy of page to the heapfile. Returns its page id.
+ */
+PageID bulk_load_page(BulkLoader *loader, Page *page);
+
+/**
+ * Write out the staged pages, the directory and the header.
+ */
+void finish_bulk_load(BulkLoader *loader);
+
+/**
+ * Start writing a column store with the given page size to file. A
+ * sort_attr other than -1 records that rows will be appended in order of
+ * that attribute.
+ */
+void init_colstore_writer(ColstoreWriter *writer, FILE *file, int page_size, int sort_attr = -1);
+
+/**
+ * Append num_rows SLOT_SIZE-byte rows. Columns are split into num_groups
+ * groups that are transposed on separate threads.
+ */
+void colstore_append_rows(ColstoreWriter *writer, const char *rows, int num_rows, int num_groups);
+
+/**
+ * Write the last row group and the footer, and close the file.
+ */
+void finish_colstore_writer(ColstoreWriter *writer);
+
+/**
+ * Read the footer of the column store in file. Returns false if file is
+ * not a column store or was written with another page size.
+ */
+bool open_colstore(Colstore *colstore, int page_size, FILE *file);
+
+void close_colstore(Colstore *colstore);
+
+/**
+ * On the sort attribute of a sorted projection, find by binary search over
+ * the page minimums and maximums the rows [*first_row, *last_row) of the
+ * pages that may hold a value within [start, end] on its first len bytes.
+ * Returns false if the column store is not sorted on attr.
+ */
+bool colstore_sorted_rows(Colstore *colstore, int attr, const char *start, const char *end, int len,
+                          uint64_t *first_row, uint64_t *last_row);
+
+/**
+ * Bytes needed to hold any column page of a store with this page size.
+ */
+int column_page_buffer_size(int page_size);
+
+/**
+ * Encode count values with the encoding that gives the smallest page.
+ * out must hold column_page_buffer_size bytes. Returns the page size.
+ */
+int encode_column_page(const char *values, int count, char *out);
+
+/**
+ * Read a column page into buf and parse it into page.
+ */
+bool read_column_page(Colstore *colstore, ColumnPageInfo *info, char *buf, EncodedPage *page);
+
+/**
+ * Parse an encoded column page of size bytes holding num_values values.
+ */
+bool parse_column_page(const char *buf, uint32_t size, uint32_t num_values, EncodedPage *page);
+
+/**
+ * range_match on an encoded page: bit i of match is set when value i is
+ * within [start, end] on its first len bytes. DICT, RLE and PACKED pages
+ * are evaluated without decoding every value.
+ */
+void column_page_match(EncodedPage *page, const char *start, const char *end, int len, uint64_t *match);
+
+/**
+ * Decode value i of the page into value (ATTRIBUTE_SIZE bytes).
+ */
+void column_page_value(EncodedPage *page, int i, char *value);
+
+/**
+ * False when no value of the page can be within [start, end] on its first
+ * len bytes, going by the smallest and largest value of the page.
+ */
+bool column_page_may_match(ColumnPageInfo *info, const char *start, const char *end, int len);
+
+/**
+ * Compress count rows, in increasing order, into bitmap.
+ */
+void bitmap_from_rows(const uint32_t *rows, long count, Bitmap *bitmap);
+
+/**
+ * Rows of bitmap, in increasing order.
+ */
+void bitmap_rows(const Bitmap *bitmap, vector<uint32_t> *rows);
+
+uint64_t bitmap_cardinality(const Bitmap *bitmap);
+
+void bitmap_and(const Bitmap *a, const Bitmap *b, Bitmap *out);
+
+void bitmap_or(const Bitmap *a, const Bitmap *b, Bitmap *out);
+
+/**
+ * Name of the bitmap index file of attribute attr_id of a column store:
+ * colstore_name.<attr_id> followed by BITMAP_INDEX_SUFFIX.
+ */
+string bitmap_index_path(const char *colstore_name, int attr_id);
+
+/**
+ * Build the bitmap index of attribute attr_id of the column store on
+ * prefixes of prefix_len bytes. Returns false if the store has too many
+ * rows for 32-bit row numbers.
+ */
+bool build_bitmap_index(BitmapIndex *index, Colstore *colstore, int attr_id, int prefix_len);
+
+void write_bitmap_index(BitmapIndex *index, FILE *file);
+
+/**
+ * Read a bitmap index written by write_bitmap_index. Returns false if file
+ * is not a bitmap index.
+ */
+bool read_bitmap_index(BitmapIndex *index, FILE *file);
+
+void free_bitmap_index(BitmapIndex *index);
+
+/**
+ * Delete the bitmap index files of every attribute of the column store.
+ */
+void remove_bitmap_indexes(const char *colstore_name);
+
+/**
+ * OR the bitmaps of the prefixes that may be within [start, end] on
+ * their first len bytes into rows. Returns true if rows are exactly the
+ * matching rows, which is when len is at most the prefix length; if not,
+ * they are candidates that still have to be compared.
+ */
+bool bitmap_index_range(BitmapIndex *index, const char *start, const char *end, int len, Bitmap *rows);
+
+/**
+ * Find a page with at least one free slot using the free space map.
+ * Returns -1 if every page is full.
+ */
+PageID find_free_page(Heapfile *heapfile);
+
+/**
+ * Record the free space of page pid, free_slots * slot_size bytes, in its
+ * directory entry and in the free space map.
+ */
+void set_page_free_slots(Heapfile *heapfile, PageID pid, int free_slots);
+
 /**
  * Read a page into memory
  */
@@ -105,17 +747,275 @@ void read_page(Heapfile *heapfile, PageID pid, Page *page);
  */
 void write_page(Page *page, Heapfile *heapfile, PageID pid);
 
+/**
+ * Open an existing heapfile stored in file, reading its header.
+ */
+void open_heapfile(Heapfile *heapfile, int page_size, FILE *file);
+
+/**
+ * Write back every dirty buffered page of the heapfile and close its file.
+ */
+void close_heapfile(Heapfile *heapfile);
+
+/**
+ * Attach the zone map stored next to the heapfile, in heapfile_name
+ * followed by ZONE_MAP_SUFFIX. With attrs, an empty zone map on them is
+ * created for a heapfile without pages; without, an existing one is
+ * opened. Zones are then kept up to date whenever a page is written.
+ * Returns false if there is no zone map.
+ */
+bool open_zone_map(Heapfile *heapfile, const char *heapfile_name, const vector<int> *attrs);
+
+/**
+ * Name of the index file of attribute attr_id of a heapfile:
+ * heapfile_name.<attr_id> followed by INDEX_SUFFIX.
+ */
+string index_path(const char *heapfile_name, int attr_id);
+
+/**
+ * Build a B+ tree index on attribute attr_id of every record of the
+ * heapfile into file, bottom up from the sorted entries.
+ */
+void build_index(BTree *tree, FILE *file, Heapfile *heapfile, int attr_id);
+
+/**
+ * Read the header of the index stored in file. Returns false if file is
+ * not an index.
+ */
+bool open_index(BTree *tree, FILE *file);
+
+/**
+ * Write the header of the index and close its file.
+ */
+void close_index(BTree *tree);
+
+void index_insert(BTree *tree, const char *value, RecordID rid);
+
+/**
+ * Remove the entry of value and rid. Leaves are not merged when they
+ * become sparse. Returns false if there was no such entry.
+ */
+bool index_delete(BTree *tree, const char *value, RecordID rid);
+
+/**
+ * Records whose value is within [start, end], compared like compare_attr,
+ * in value order.
+ */
+void index_range(BTree *tree, const char *start, const char *end, vector<RecordID> *rids);
+
+/**
+ * Name of the hash index file of attribute attr_id of a heapfile:
+ * heapfile_name.<attr_id> followed by HASH_INDEX_SUFFIX.
+ */
+string hash_index_path(const char *heapfile_name, int attr_id);
+
+/**
+ * Build a hash index on attribute attr_id of every record of the heapfile
+ * into file. The directory is sized up front so every bucket is written
+ * once.
+ */
+void build_hash_index(HashIndex *index, FILE *file, Heapfile *heapfile, int attr_id);
+
+/**
+ * Read the header of the hash index stored in file. Returns false if file
+ * is not a hash index.
+ */
+bool open_hash_index(HashIndex *index, FILE *file);
+
+/**
+ * Write the header of the hash index and close its file.
+ */
+void close_hash_index(HashIndex *index);
+
+/**
+ * Add an entry, splitting its bucket when it is full.
+ */
+void hash_index_insert(HashIndex *index, const char *value, RecordID rid);
+
+/**
+ * Remove the entry of value and rid. Buckets are not merged. Returns
+ * false if there was no such entry.
+ */
+bool hash_index_delete(HashIndex *index, const char *value, RecordID rid);
+
+/**
+ * Records whose value equals value (ATTRIBUTE_SIZE bytes). Reads the
+ * header, one directory slot and the bucket's pages.
+ */
+void hash_index_lookup(HashIndex *index, const char *value, vector<RecordID> *rids);
+
+/**
+ * Attach every index of the heapfile found next to it, B+ tree and hash
+ * indexes alike. Returns how many were found.
+ */
+int open_indexes(Heapfile *heapfile, const char *heapfile_name);
+
+/**
+ * Bring the attached indexes up to date after the record rid changed from
+ * old_row to new_row (SLOT_SIZE bytes each). old_row is NULL for a new
+ * record and new_row is NULL for a deleted one.
+ */
+void update_indexes(Heapfile *heapfile, RecordID rid, const char *old_row, const char *new_row);
+
+/**
+ * Delete the index files, of either kind, of every attribute of the
+ * heapfile.
+ */
+void remove_indexes(const char *heapfile_name);
+
+/**
+ * Read batch operations from file, one per line: "<page_id>-<slot>" for
+ * deletes, "<page_id>-<slot> <attribute_id> <new_value>" for updates,
+ * with nothing else on the line. Returns false on the first malformed or
+ * overlong line, reporting it on stderr.
+ */
+bool read_record_ops(FILE *file, bool updates, vector<RecordOp> *ops);
+
+/**
+ * Apply ops page by page: ops are ordered by page, keeping their order
+ * within a page, and each page is pinned once for all of its ops, so it
+ * is read and written once. Indexes are kept up to date. Ops on missing
+ * records are skipped. Returns the number of ops applied.
+ */
+long apply_record_ops(Heapfile *heapfile, vector<RecordOp> *ops);
+
+/**
+ * Pages of the heapfile that may hold a record whose attribute attr_id is
+ * within [start, end], compared like compare_attr. Every page is returned
+ * when the heapfile has no zone map on attr_id.
+ */
+void zone_map_pages(Heapfile *heapfile, int attr_id, const char *start, const char *end, vector<PageID> *pages);
+
+/**
+ * Name of the Bloom filter sidecar of a heapfile or column store: name
+ * followed by BLOOM_SUFFIX.
+ */
+string bloom_path(const char *name);
+
+/**
+ * Empty Bloom filters on attrs for pages of up to values_per_page values.
+ */
+void init_bloom_filters(BloomFilters *bloom, int values_per_page, const vector<int> &attrs);
+
+/**
+ * Add value (ATTRIBUTE_SIZE bytes) to the filter of page i on attr_id.
+ */
+void bloom_add(BloomFilters *bloom, int attr_id, long i, const char *value);
+
+/**
+ * False only if page i holds no value equal to value on attr_id. Always
+ * true for attributes or pages without a filter.
+ */
+bool bloom_may_contain(BloomFilters *bloom, int attr_id, long i, const char *value);
+
+void write_bloom_filters(BloomFilters *bloom, FILE *file);
+
+/**
+ * Read Bloom filters written by write_bloom_filters. Returns false if file
+ * does not hold any.
+ */
+bool read_bloom_filters(BloomFilters *bloom, FILE *file);
+
+void free_bloom_filters(BloomFilters *bloom);
+
+/**
+ * Attach the Bloom filters of the heapfile, kept up to date as pages are
+ * written. With attrs, create empty filters on them for an empty
+ * heapfile; without, open existing ones. Returns false if there are none.
+ */
+bool open_bloom_filters(Heapfile *heapfile, const char *heapfile_name, const vector<int> *attrs);
+
+/**
+ * Drop from pages those whose Bloom filter on attr_id rules out value
+ * (ATTRIBUTE_SIZE bytes).
+ */
+void bloom_filter_pages(Heapfile *heapfile, int attr_id, const char *value, vector<PageID> *pages);
+
+/**
+ * Size the buffer pool to num_frames pages. Must be called before any
+ * page is buffered; otherwise DEFAULT_BUFFER_POOL_FRAMES frames are used.
+ */
+void init_buffer_pool(int num_frames);
+
+/**
+ * Pin a page in the buffer pool and return the buffered copy, or NULL if
+ * the page does not exist. The page stays in memory until unpinned.
+ */
+Page *pin_page(Heapfile *heapfile, PageID pid);
+
+/**
+ * Release a pin taken by pin_page. Set dirty if the buffered page was modified.
+ */
+void unpin_page(Heapfile *heapfile, PageID pid, bool dirty);
+
+/**
+ * Write all dirty buffered pages of the heapfile back to disk.
+ */
+void flush_heapfile(Heapfile *heapfile);
+
+/**
+ * Ask the kernel to start reading pages first..last in the background so a
+ * later pin_page finds them in the page cache.
+ */
+void prefetch_pages(Heapfile *heapfile, PageID first, PageID last);
+
+/**
+ * Hit/miss counters of the buffer pool.
+ */
+BufferPoolStats buffer_pool_stats();
+
+void print_buffer_pool_stats(FILE *out);
+
 /**
  * Read lines in file into page. Return when page is full.
  */
 int read_csv2page(ifstream *file, Page *page);
 
+/**
+ * Split the CSV lines of [begin, end) into SLOT_SIZE-byte rows appended to
+ * rows, skipping blank lines. Field i of a row is stored at
+ * i * ATTRIBUTE_SIZE with quotes removed, padded with spaces. Fields that are not
+ * ATTRIBUTE_SIZE wide and rows without ATTR_PER_RECORD fields are added
+ * to errors when it is not NULL. Returns the number of rows.
+ */
+int tokenize_csv(const char *begin, const char *end, vector<char> *rows, CsvErrors *errors);
+
+/**
+ * Bit i of the result is set when p[i] is ',', '"' or '\n'. p must have
+ * 64 readable bytes. csv_delimiters picks the kernel at runtime.
+ */
+uint64_t csv_delimiters(const char *p);
+
+uint64_t csv_delimiters_scalar(const char *p);
+
+uint64_t csv_delimiters_sse2(const char *p);
+
+uint64_t csv_delimiters_avx2(const char *p);
+
+/**
+ * Memory-map csv_file, split it into newline-aligned chunks of about
+ * CSV_CHUNK_SIZE bytes and parse the chunks with num_threads threads.
+ * Parsed rows are passed to callback in file order and malformed rows
+ * are reported on stderr. Returns the number of rows, or -1 if the file
+ * cannot be read.
+ */
+long parallel_load_csv(const char *csv_file, int num_threads, RowsCallback callback, void *arg);
+
 /*
- * Helper functions to read/write byte array into buf..
+ * Helper functions for the slot bitmap of a page.
  */
-void read_bytes(void *buf, int numSlots, ByteArray *slot_info);
+int slot_bitmap_size(Page *page);
+
+int slot_bitmap_words(int num_slots);
+
+bool slot_is_used(Page *page, int slot);
 
-void write_bytes(ByteArray *slot_info, void *buf);
+void set_slot_used(Page *page, int slot, bool used);
+
+/**
+ * Find the first free slot of the page, or -1 if the page is full.
+ */
+int find_free_slot(Page *page);
 
 
 /**
@@ -134,10 +1034,23 @@ class RecordIterator {
         int page_size;
         Page *cur_page;
         bool has_next;
+        PageID prev_pid; // page left by the last call, kept pinned for its views
+        int read_ahead;  // pages to request ahead of cur_page, 0 disables it
+        const vector<PageID> *pages; // pages to visit, NULL for every page
+        int page_index;  // position of cur_page among the pages to visit
+        int prefetched;  // number of pages to visit requested so far
+        PageID page_at(int index);
         void find_next();
+        void prefetch();
+        bool next_page();
+        void release_prev();
     public:
-        RecordIterator(Heapfile *hFile);
-        Record next();
+        RecordIterator(Heapfile *hFile, int read_ahead = DEFAULT_READ_AHEAD_PAGES,
+                       const vector<PageID> *pages = NULL);
+        ~RecordIterator();
+        Record next(Arena *arena = NULL);
+        RecordView next_view();
+        int next_batch(RecordBatch *batch, int max);
         bool hasNext();
         RecordID *cur_rid;
 };
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "library.h"
+
+using namespace std;
+
+void check_argv(int argc, char *argv[]);
+long lookup(Heapfile *heapfile, HashIndex *index, const char *value);
+
+int main(int argc, char *argv[]) {
+    check_argv(argc, argv);
+
+    char *heapfile_name = argv[1];
+    int attr_id = atoi(argv[2]);
+    char *value = argv[3];
+    int page_size = atoi(argv[4]);
+
+    //start timer
+    long start = wall_clock_msec();
+
+    // Values are stored padded with spaces, as update writes them.
+    char lookup_value[ATTRIBUTE_SIZE];
+    for (int i = 0; i < ATTRIBUTE_SIZE; i++) {
+        lookup_value[i] = (i < strlen(value)) ? value[i] : ' ';
+    }
+
+    // Initialize heap file.
+    Heapfile *heapfile = new Heapfile;
+    FILE *f = fopen(heapfile_name, "rb+");
+    if (f == NULL) {
+        fputs("heap file doesn't exist.\n", stderr);
+        exit(2);
+    }
+    open_heapfile(heapfile, page_size, f);
+    open_indexes(heapfile, heapfile_name);
+
+    HashIndex *index = NULL;
+    for (int i = 0; i < heapfile->hash_indexes->size(); i++) {
+        if (heapfile->hash_indexes->at(i)->attr_id == attr_id) {
+            index = heapfile->hash_indexes->at(i);
+        }
+    }
+    if (index == NULL) {
+        fputs("attribute has no hash index, run build_index with hash first.\n", stderr);
+        exit(2);
+    }
+
+    long count = lookup(heapfile, index, lookup_value);
+    cout << "Total number of records: " << count << endl;
+
+    close_heapfile(heapfile);
+
+    print_buffer_pool_stats(stdout);
+
+    fprintf(stdout, "TIME: %ld milliseconds\n", wall_clock_msec() - start);
+}
+
+void check_argv(int argc, char *argv[]) {
+    if(argc != 5) {
+        fputs("usage: lookup <heapfile> <attribute_id> <value> <page_size>\n",stderr);
+        exit(2);
+    }
+
+    if ((atoi(argv[2]) <= 0 or atoi(argv[2]) >= ATTR_PER_RECORD) && !(strcmp(argv[2], "0") == 0)) {
+        fprintf(stderr, "usage: <attribute_id> must be integer and greater or equal to zero and smaller than number of attribute which is %d \n", ATTR_PER_RECORD);
+        exit(2);
+    }
+
+    if (strlen(argv[3]) > ATTRIBUTE_SIZE) {
+        fprintf(stderr, "usage: length of <value> must less than or equal to %d \n", ATTRIBUTE_SIZE);
+        exit(2);
+    }
+
+    if (atoi(argv[4]) <= 0) {
+        fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
+}
+
+static bool rid_less(const RecordID &a, const RecordID &b) {
+    return a.page_id < b.page_id || (a.page_id == b.page_id && a.slot < b.slot);
+}
+
+/**
+ * Print every record whose attribute equals value, the way scan does.
+ * Records are fetched by RID in page order, so each page is read once.
+ */
+long lookup(Heapfile *heapfile, HashIndex *index, const char *value) {
+    vector<RecordID> rids;
+    hash_index_lookup(index, value, &rids);
+    sort(rids.begin(), rids.end(), rid_less);
+
+    long count = 0;
+    Page *page = NULL;
+    PageID pid = -1;
+    for (int i = 0; i < rids.size(); i++) {
+        if (rids[i].page_id != pid) {
+            if (page != NULL) {
+                unpin_page(heapfile, pid, false);
+            }
+            pid = rids[i].page_id;
+            page = pin_page(heapfile, pid);
+        }
+        RecordView record;
+        if (page == NULL || !read_fixed_len_page_view(page, rids[i].slot, &record)) {
+            continue;
+        }
+        count++;
+        cout << "pageID " << pid << ", slot " << rids[i].slot << ": ";
+        for (int j = 0; j < record_view_size(&record); j++) {
+            AttrView attr = record_view_attr(&record, j);
+            cout.write(attr.data, attr.len);
+            if (j != record_view_size(&record) - 1) {
+                cout << ", ";
+            }
+        }
+        cout << endl;
+    }
+    if (page != NULL) {
+        unpin_page(heapfile, pid, false);
+    }
+    return count;
+}
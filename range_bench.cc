@@ -0,0 +1,79 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "library.h"
+
+typedef void (*Kernel)(const char *, int, const char *, const char *, int, uint64_t *);
+
+double bench(Kernel kernel, const char *values, int count, const char *start, const char *end, int len, uint64_t *match, int rounds);
+
+/**
+ * Benchmark the range predicate kernels on random column values. The scalar
+ * kernel is the per-value memcmp loop select2 used before the SIMD kernels.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc != 5)
+	{
+		fprintf(stderr, "USAGE: range_bench <num_values> <start> <end> <rounds>\n");
+		exit(1);
+	}
+
+	int count = atoi(argv[1]);
+	char *startVal = argv[2];
+	char *endVal = argv[3];
+	int rounds = atoi(argv[4]);
+	if (count <= 0 || rounds <= 0)
+	{
+		fprintf(stderr, "<num_values> and <rounds> must be greater than 0.\n");
+		exit(1);
+	}
+
+	int comparelen = (strlen(startVal) < ATTRIBUTE_SIZE) ? strlen(startVal)  : ATTRIBUTE_SIZE;
+	comparelen = (strlen(endVal) < comparelen) ? strlen(endVal) : comparelen;
+
+	//same alphabet as csvgen
+	char *values = (char *) malloc(count * ATTRIBUTE_SIZE);
+	for (int i = 0; i < count * ATTRIBUTE_SIZE; i++)
+		values[i] = 'a' + rand() % 25;
+
+	int words = (count + 63) / 64;
+	uint64_t *expected = (uint64_t *) malloc(words * sizeof(uint64_t));
+	uint64_t *match = (uint64_t *) malloc(words * sizeof(uint64_t));
+
+	const char *names[] = {"scalar", "sse2", "avx2"};
+	Kernel kernels[] = {range_match_scalar, range_match_sse2, range_match_avx2};
+	int num_kernels = cpu_has_avx2() ? 3 : 2;
+
+	range_match_scalar(values, count, startVal, endVal, comparelen, expected);
+	for (int k = 0; k < num_kernels; k++)
+	{
+		double seconds = bench(kernels[k], values, count, startVal, endVal, comparelen, match, rounds);
+		if (memcmp(match, expected, words * sizeof(uint64_t)) != 0)
+		{
+			fprintf(stderr, "Kernel %s disagrees with the scalar kernel\n", names[k]);
+			exit(1);
+		}
+		fprintf(stdout, "%-8s %8.1f M values/s\n", names[k], (double) count * rounds / seconds / 1e6);
+	}
+
+	int matches = 0;
+	for (int w = 0; w < words; w++)
+		matches += __builtin_popcountll(expected[w]);
+	fprintf(stdout, "MATCHES: %d of %d\n", matches, count);
+
+	free(values);
+	free(expected);
+	free(match);
+	return 0;
+}
+
+double bench(Kernel kernel, const char *values, int count, const char *start, const char *end, int len, uint64_t *match, int rounds)
+{
+	clock_t start_timer = clock();
+	for (int r = 0; r < rounds; r++)
+		kernel(values, count, start, end, len, match);
+	return (double) (clock() - start_timer) / CLOCKS_PER_SEC;
+}
@@ -34,20 +34,15 @@ int main(int argc, char *argv[])
 
 		//read in metadata first
 
-		char *slotInfo = (char *)malloc(fixed_len_page_capacity(page) * sizeof(char));
 		fread(page, sizeof(Page), 1, pageFile);
 
 		//cout << "Read some metadata" << endl;
 		//fprintf(stdout, "Page read in with pageSize %d, slotsize %d\n", page->page_size, page->slot_size);
 
-
-		fread(slotInfo, fixed_len_page_capacity(page) * sizeof(char), 1, pageFile);
+		page->slot_bitmap = (uint64_t *)calloc(slot_bitmap_words(fixed_len_page_capacity(page)), sizeof(uint64_t));
+		fread(page->slot_bitmap, slot_bitmap_size(page), 1, pageFile);
 
 		//cout << "Read in slot info" << endl;
-
-		page->slot_info = new ByteArray;
-
-		read_bytes(slotInfo, fixed_len_page_capacity(page), page->slot_info);	
 		//cout << "Metadata read successfully" << endl;
 		
 		page->data = malloc(pageSize);
@@ -61,7 +56,7 @@ int main(int argc, char *argv[])
 			Record *rec = new Record();
 			//char *buf = (char*) malloc(ATTRIBUTE_SIZE + 1);
 			//memset(buf, '\0', ATTRIBUTE_SIZE + 1);
-			if (page->slot_info->at(slot) == '1')
+			if (slot_is_used(page, slot))
 			{
 				read_fixed_len_page(page, slot, rec); //if slot empty, record empty
 				
@@ -10,26 +10,31 @@
 using namespace std;
 
 void check_argv(int argc, char *argv[]);
-void scan(char *heapfile_name, int page_size);
+void scan(char *heapfile_name, int page_size, int num_threads, bool ordered);
+int print_page(Page *page, PageID pid, string *out, void *arg);
 
 int main(int argc, char *argv[]) {
     check_argv(argc, argv);
 
     char *heapfile_name = argv[1];
     int page_size = atoi(argv[2]);
+    int num_threads = (argc > 3) ? atoi(argv[3]) : 0;
+    bool ordered = (argc <= 4);
 
-    //start timer
-    clock_t start = clock();
+    //start timer (wall clock, since the scan may use several threads)
+    long start = wall_clock_msec();
 
-    scan(heapfile_name, page_size);
+    scan(heapfile_name, page_size, num_threads, ordered);
 
-    int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+    print_buffer_pool_stats(stdout);
+
+    int msecTime = wall_clock_msec() - start;
     fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
 }
 
 void check_argv(int argc, char *argv[]) {
-    if(argc != 3) {
-        fputs("usage: scan <heapfile> <page_size>\n",stderr);
+    if(argc < 3 || argc > 5 || (argc == 5 && strcmp(argv[4], "unordered") != 0)) {
+        fputs("usage: scan <heapfile> <page_size> [<num_threads> [unordered]]\n",stderr);
         exit(2);
     }
 
@@ -37,21 +42,33 @@ void check_argv(int argc, char *argv[]) {
         fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
         exit(2);
     }
+
+    if (argc > 3 && atoi(argv[3]) <= 0) {
+        fputs("usage: <num_threads> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
 }
 
 /**
  * Scan all records in heapfile using the given page_size.
+ * With num_threads > 0 pages are scanned in parallel.
  */
-void scan(char *heapfile_name, int page_size) {
+void scan(char *heapfile_name, int page_size, int num_threads, bool ordered) {
     Heapfile *heapfile = new Heapfile;
     FILE *f = fopen(heapfile_name, "rb+");
-    fread(heapfile, sizeof(Heapfile), 1, f);
-    heapfile->file_ptr = f;
-    heapfile->page_size = page_size;
-    if (heapfile->file_ptr == NULL) {
+    if (f == NULL) {
         fputs("heap file doesn't exist.\n", stderr);
         exit(2);
     }
+    open_heapfile(heapfile, page_size, f);
+
+    if (num_threads > 0) {
+        long count = parallel_scan(heapfile, num_threads, DEFAULT_MORSEL_PAGES, ordered,
+                                   print_page, NULL, stdout);
+        cout << "Total number of records: " << count << endl;
+        close_heapfile(heapfile);
+        return;
+    }
 
     uint32_t count = 0;
     RecordIterator *i = new RecordIterator(heapfile);
@@ -59,16 +76,43 @@ void scan(char *heapfile_name, int page_size) {
         count++;
         cout << "pageID " << i->cur_rid->page_id;
         cout << ", slot " << i->cur_rid->slot << ": ";
-        Record record = i->next();
-        for (int j = 0; j < record.size(); j++) {
-            cout << record.at(j);
-            if (j != record.size() - 1) {
+        RecordView record = i->next_view();
+        for (int j = 0; j < record_view_size(&record); j++) {
+            AttrView attr = record_view_attr(&record, j);
+            cout.write(attr.data, attr.len);
+            if (j != record_view_size(&record) - 1) {
                 cout << ", ";
             }
         }
         cout << endl;
     }
     cout << "Total number of records: " << count << endl;
-    fflush(heapfile->file_ptr);
-    fclose(heapfile->file_ptr);
+    delete i;
+    close_heapfile(heapfile);
+}
+
+/**
+ * Format every record of the page the same way the sequential scan does.
+ */
+int print_page(Page *page, PageID pid, string *out, void *arg) {
+    int count = 0;
+    char prefix[64];
+    RecordView record;
+    for (int slot = 0; slot < fixed_len_page_capacity(page); slot++) {
+        if (!read_fixed_len_page_view(page, slot, &record)) {
+            continue;
+        }
+        count++;
+        int len = snprintf(prefix, sizeof(prefix), "pageID %d, slot %d: ", pid, slot);
+        out->append(prefix, len);
+        for (int j = 0; j < record_view_size(&record); j++) {
+            AttrView attr = record_view_attr(&record, j);
+            out->append(attr.data, attr.len);
+            if (j != record_view_size(&record) - 1) {
+                out->append(", ");
+            }
+        }
+        out->push_back('\n');
+    }
+    return count;
 }
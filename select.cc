@@ -4,12 +4,21 @@
 #include <string>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include "library.h"
 
 using namespace std;
 
 void check_argv(int argc, char *argv[]);
-void select(char *heapfile_name, int page_size, int attr_id, char *start, char *end);
+void select(Heapfile *heapfile, vector<PageID> *pages, int attr_id, char *start, char *end);
+void select_by_index(Heapfile *heapfile, BTree *tree, int attr_id, char *start, char *end);
+int select_page(Page *page, PageID pid, string *out, void *arg);
+
+typedef struct {
+    int attr_id;
+    char *start;
+    char *end;
+} Query;
 
 int main(int argc, char *argv[]) {
     check_argv(argc, argv);
@@ -19,32 +28,66 @@ int main(int argc, char *argv[]) {
     char *start = argv[3];
     char *end = argv[4];
     int page_size = atoi(argv[5]);
+    bool use_index = (argc == 7 && strcmp(argv[6], "index") == 0);
+    int num_threads = (argc > 6 && !use_index) ? atoi(argv[6]) : 0;
+    bool ordered = (argc <= 7);
 
-    //start timer
-    clock_t start_timer = clock();
+    //start timer (wall clock, since the select may use several threads)
+    long start_timer = wall_clock_msec();
 
     // Initialize heap file.
     Heapfile *heapfile = new Heapfile;
     FILE *f = fopen(heapfile_name, "rb+");
-    fread(heapfile, sizeof(Heapfile), 1, f);
-    heapfile->file_ptr = f;
-    heapfile->page_size = page_size;
-    if (heapfile->file_ptr == NULL) {
+    if (f == NULL) {
         fputs("heap file doesn't exist.\n", stderr);
         exit(2);
     }
+    open_heapfile(heapfile, page_size, f);
+    open_zone_map(heapfile, heapfile_name, NULL);
+    open_bloom_filters(heapfile, heapfile_name, NULL);
+    open_indexes(heapfile, heapfile_name);
+
+    BTree *tree = NULL;
+    for (int i = 0; i < heapfile->indexes->size(); i++) {
+        if (heapfile->indexes->at(i)->attr_id == attr_id) {
+            tree = heapfile->indexes->at(i);
+        }
+    }
+    if (use_index && tree == NULL) {
+        fputs("attribute has no index, run build_index first.\n", stderr);
+        exit(2);
+    }
 
-    select(heapfile_name, page_size, attr_id, start, end);
+    // Pages whose zone can't hold a match are never read, nor, for an
+    // equality, pages whose Bloom filter rules the value out.
+    vector<PageID> pages;
+    if (!use_index) {
+        zone_map_pages(heapfile, attr_id, start, end, &pages);
+        if (strcmp(start, end) == 0 && strlen(start) == ATTRIBUTE_SIZE) {
+            bloom_filter_pages(heapfile, attr_id, start, &pages);
+        }
+    }
+
+    if (use_index) {
+        select_by_index(heapfile, tree, attr_id, start, end);
+    } else if (num_threads > 0) {
+        Query query = {attr_id, start, end};
+        parallel_scan(heapfile, num_threads, DEFAULT_MORSEL_PAGES, ordered, select_page, &query, stdout, &pages);
+    } else {
+        select(heapfile, &pages, attr_id, start, end);
+    }
 
-    fclose(f);
+    close_heapfile(heapfile);
 
-    int msecTime = (clock() - start_timer) * 1000 / CLOCKS_PER_SEC;
+    print_buffer_pool_stats(stdout);
+
+    int msecTime = wall_clock_msec() - start_timer;
     fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
 }
 
 void check_argv(int argc, char *argv[]) {
-    if(argc != 6) {
-        fputs("usage: select <heapfile> <attribute_id> <start> <end> <page_size>\n",stderr);
+    if(argc < 6 || argc > 8 || (argc == 8 && strcmp(argv[7], "unordered") != 0)) {
+        fputs("usage: select <heapfile> <attribute_id> <start> <end> <page_size> [<num_threads> [unordered] | index]\n",stderr);
         exit(2);
     }
 
@@ -57,38 +100,89 @@ void check_argv(int argc, char *argv[]) {
         fputs("usage: <page_size> must be integer and greater than zero\n",stderr);
         exit(2);
     }
+
+    if (argc > 6 && atoi(argv[6]) <= 0 && !(argc == 7 && strcmp(argv[6], "index") == 0)) {
+        fputs("usage: <num_threads> must be integer and greater than zero\n",stderr);
+        exit(2);
+    }
 }
 
 /**
- * Select all records in heapfile using the given page_size.
+ * Select the matching records of the given pages of heapfile.
  */
-void select(char *heapfile_name, int page_size, int attr_id, char *start, char *end) {
-    Heapfile *heapfile = new Heapfile;
-    FILE *f = fopen(heapfile_name, "rb+");
-    fread(heapfile, sizeof(Heapfile), 1, f);
-    heapfile->file_ptr = f;
-    if (heapfile->file_ptr == NULL) {
-        fputs("heap file doesn't exist.\n", stderr);
-        exit(2);
+void select(Heapfile *heapfile, vector<PageID> *pages, int attr_id, char *start, char *end) {
+    RecordIterator *i = new RecordIterator(heapfile, DEFAULT_READ_AHEAD_PAGES, pages);
+    RecordBatch batch;
+    while (i->next_batch(&batch, RECORD_BATCH_SIZE) > 0) {
+        for (int row = 0; row < batch.size; row++) {
+            RecordView record = batch_row(&batch, row);
+            AttrView attr = record_view_attr(&record, attr_id);
+
+            int compare_start = compare_attr(attr, start);
+            int compare_end = compare_attr(attr, end);
+
+            if (compare_start >= 0 && compare_end <= 0) {
+                cout.write(attr.data, min(attr.len, 5));
+                cout << endl;
+            }
+        }
     }
+    delete i;
+}
 
-    RecordIterator *i = new RecordIterator(heapfile);
-    while (i->hasNext()) {
-        char *buf = (char *) malloc(SLOT_SIZE);
-        Record record = i->next();
-        char *attr = (char *) malloc(ATTRIBUTE_SIZE);
-        write_attr(&record, attr_id, attr);
-
-        int compare_start = strcmp(start, attr);
-        int compare_end = strcmp(end, attr);
+static bool rid_less(const RecordID &a, const RecordID &b) {
+    return a.page_id < b.page_id || (a.page_id == b.page_id && a.slot < b.slot);
+}
 
-        if (compare_start <= 0 && compare_end >= 0) {
-            if (ATTRIBUTE_SIZE > 5) {
-                attr[5] = '\0';
+/**
+ * Select through the B+ tree index on attr_id. Matching records are
+ * fetched by RID in page order, so each page is read once.
+ */
+void select_by_index(Heapfile *heapfile, BTree *tree, int attr_id, char *start, char *end) {
+    vector<RecordID> rids;
+    index_range(tree, start, end, &rids);
+    sort(rids.begin(), rids.end(), rid_less);
+
+    Page *page = NULL;
+    PageID pid = -1;
+    for (int i = 0; i < rids.size(); i++) {
+        if (rids[i].page_id != pid) {
+            if (page != NULL) {
+                unpin_page(heapfile, pid, false);
             }
-            cout << attr << endl;
+            pid = rids[i].page_id;
+            page = pin_page(heapfile, pid);
         }
+        RecordView record;
+        if (page == NULL || !read_fixed_len_page_view(page, rids[i].slot, &record)) {
+            continue;
+        }
+        AttrView attr = record_view_attr(&record, attr_id);
+        cout.write(attr.data, min(attr.len, 5));
+        cout << endl;
+    }
+    if (page != NULL) {
+        unpin_page(heapfile, pid, false);
     }
-    fflush(heapfile->file_ptr);
-    fclose(heapfile->file_ptr);
-}
\ No newline at end of file
+}
+
+/**
+ * Select the matching records of one page for parallel_scan.
+ */
+int select_page(Page *page, PageID pid, string *out, void *arg) {
+    Query *query = (Query *) arg;
+    int count = 0;
+    RecordView record;
+    for (int slot = 0; slot < fixed_len_page_capacity(page); slot++) {
+        if (!read_fixed_len_page_view(page, slot, &record)) {
+            continue;
+        }
+        AttrView attr = record_view_attr(&record, query->attr_id);
+        if (compare_attr(attr, query->start) >= 0 && compare_attr(attr, query->end) <= 0) {
+            out->append(attr.data, min(attr.len, 5));
+            out->push_back('\n');
+            count++;
+        }
+    }
+    return count;
+}
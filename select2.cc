@@ -1,103 +1,172 @@
 #include <iostream>
 #include <iterator>
-#include <sys/types.h>
-#include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <errno.h>
-#include <unistd.h>
 #include "library.h"
 
+typedef struct {
+	char *startVal;
+	char *endVal;
+	int comparelen;
+} Query;
+
+int select_column_page(EncodedPage *page, string *out, void *arg);
 
 int main(int argc, char *argv[]){
-	if (argc != 6)
+	if (argc < 6 || argc > 8 || (argc == 8 && strcmp(argv[7], "unordered") != 0))
 	{
 		fprintf(stderr, "USAGE: select2 <colstore_name> <attribute_id> <start>"
-			"<end> <page_size>\n");
+			"<end> <page_size> [<num_threads> [unordered]]\n");
 		exit(1);
 	}
 
-	//start timer
-    clock_t start = clock();
+	//start timer (wall clock, since the select may use several threads)
+	long start = wall_clock_msec();
 
-	char *dirName = argv[1];
-	char *fileName = argv[2];
+	char *storeName = argv[1];
+	char *attrName = argv[2];
 	char *startVal = argv[3];
 	char *endVal = argv[4];
 	int pageSize = atoi(argv[5]);
+	int numThreads = (argc > 6) ? atoi(argv[6]) : 0;
+	bool ordered = (argc <= 7);
 
-	//assuming: colstore_name is a directory that exists
-	DIR *colStore = opendir(dirName);
-	if (colStore == NULL)
+	int attr = atoi(attrName);
+	if (attr < 0 || attr >= ATTR_PER_RECORD)
 	{
-		fprintf(stderr, "Could not open directory %s for reading. Exiting with error: %d\n",
-			dirName, errno);
+		fprintf(stderr, "Could not find column for attribute %s", attrName);
 		exit(1);
-
-	}
-
-	struct dirent *entr = readdir(colStore);
-
-	while (entr != NULL)
-	{
-		if (strncmp(entr->d_name, fileName, strlen(fileName)) == 0)
-			break;
-		entr = readdir(colStore);
 	}
 
-	if (entr == NULL)
+	FILE *f = fopen(storeName, "rb");
+	if (f == NULL)
 	{
-		fprintf(stderr, "Could not find file for attribute %s", fileName);
+		fprintf(stderr, "Could not open column store %s for reading.\n", storeName);
 		exit(1);
 	}
-	closedir(colStore);
-
-	if (chdir(dirName) == -1)
+	Colstore colstore;
+	if (!open_colstore(&colstore, pageSize, f))
 	{
-		fprintf(stderr, "Could not navigate to storage directory: %s\n", dirName);
 		exit(1);
 	}
 
-	Heapfile *hpFile = new Heapfile();
-	FILE *f = fopen(fileName, "rb");
-    fread(hpFile, sizeof(Heapfile), 1, f);
-    hpFile->file_ptr = f;
-    hpFile->page_size = pageSize;
-
-	//cout << "Heapfile initialized for attributeId: " << fileName << endl;
-
-	RecordIterator *recIter = new RecordIterator(hpFile);
-	
 	int comparelen = (strlen(startVal) < ATTRIBUTE_SIZE) ? strlen(startVal)  : ATTRIBUTE_SIZE;
 	comparelen = (strlen(endVal) < comparelen) ? strlen(endVal) : comparelen;
 
 	//cout << "Length of comparison is :" << comparelen << endl;
 
-	while (recIter->hasNext())
+	//an equality on whole values only reads pages whose Bloom filter may
+	//hold the value, when the store has them
+	BloomFilters bloom;
+	BloomFilters *pageFilter = NULL;
+	FILE *bloomFile = fopen(bloom_path(storeName).c_str(), "rb");
+	if (bloomFile != NULL)
 	{
-		Record rec = recIter->next();
-		if(rec.size() != 1)
+		if (comparelen == ATTRIBUTE_SIZE && memcmp(startVal, endVal, comparelen) == 0
+			&& read_bloom_filters(&bloom, bloomFile))
 		{
-			fprintf(stderr, "Error: Record size is %d\n", (int)rec.size());
-			exit(1);
+			pageFilter = &bloom;
 		}
+		fclose(bloomFile);
+	}
 
-		if (memcmp(startVal, rec[0], comparelen) <= 0
-			&& memcmp(endVal, rec[0], comparelen) >= 0)
+	Query query = {startVal, endVal, comparelen};
+	if (numThreads > 0)
+	{
+		parallel_scan_column(&colstore, attr, numThreads, DEFAULT_MORSEL_PAGES, ordered,
+			select_column_page, &query, stdout, startVal, endVal, comparelen, pageFilter);
+	}
+	else
+	{
+		//only the chunks of the selected attribute are read
+		char *buf = (char *) malloc(column_page_buffer_size(pageSize));
+		EncodedPage page;
+		std::string out;
+
+		//on the sort attribute, the rows of the range are found by binary
+		//search and the scan stops after the last page that holds them
+		uint64_t firstRow = 0;
+		uint64_t lastRow = colstore.num_rows;
+		bool sorted = colstore_sorted_rows(&colstore, attr, startVal, endVal, comparelen, &firstRow, &lastRow);
+		int valuesPerPage = pageSize / ATTRIBUTE_SIZE;
+		long groupFirstPage = 0; //pages of the column in earlier row groups
+		for (int g = 0; g < colstore.row_groups->size(); g++)
 		{
-			char ret[6];
-			memset(ret, '\0', 6);
-			strncpy(ret, rec[0], 5);
-			fprintf(stdout, "%s \n", ret);
+			RowGroup *group = &colstore.row_groups->at(g);
+			std::vector<ColumnPageInfo> *chunk = &group->chunks[attr];
+			groupFirstPage += (g > 0) ? colstore.row_groups->at(g - 1).chunks[attr].size() : 0;
+			if (group->first_row >= lastRow)
+			{
+				break;
+			}
+			if (group->first_row + group->num_rows <= firstRow)
+			{
+				continue;
+			}
+			int p = (firstRow > group->first_row) ? (firstRow - group->first_row) / valuesPerPage : 0;
+			for (; p < chunk->size() && group->first_row + (uint64_t) p * valuesPerPage < lastRow; p++)
+			{
+				//pages whose min and max rule out a match are not read
+				if (!sorted && !column_page_may_match(&chunk->at(p), startVal, endVal, comparelen))
+				{
+					continue;
+				}
+				if (pageFilter != NULL && !bloom_may_contain(pageFilter, attr, groupFirstPage + p, startVal))
+				{
+					continue;
+				}
+				if (!read_column_page(&colstore, &chunk->at(p), buf, &page))
+				{
+					exit(1);
+				}
+				out.clear();
+				select_column_page(&page, &out, &query);
+				fwrite(out.data(), 1, out.size(), stdout);
+			}
 		}
+		free(buf);
 	}
 
-	fclose(hpFile->file_ptr);
+	if (pageFilter != NULL)
+	{
+		free_bloom_filters(pageFilter);
+	}
+	close_colstore(&colstore);
 
-	int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+	int msecTime = wall_clock_msec() - start;
     fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
 
 
 	return 0;
 }
+
+/**
+ * Select the matching values of one column page. The predicate is
+ * evaluated on the encoded page; only matching values are decoded.
+ */
+int select_column_page(EncodedPage *page, string *out, void *arg)
+{
+	Query *query = (Query *) arg;
+
+	int words = slot_bitmap_words(page->num_values);
+	std::vector<uint64_t> match(words);
+	column_page_match(page, query->startVal, query->endVal, query->comparelen, &match[0]);
+
+	int count = 0;
+	char value[ATTRIBUTE_SIZE];
+	char ret[16];
+	for (int w = 0; w < words; w++)
+	{
+		uint64_t bits = match[w];
+		while (bits != 0)
+		{
+			int slot = w * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			column_page_value(page, slot, value);
+			int len = snprintf(ret, sizeof(ret), "%.5s \n", value);
+			out->append(ret, len);
+			count++;
+		}
+	}
+	return count;
+}
@@ -1,184 +1,251 @@
 #include <iostream>
 #include <iterator>
-#include <sys/types.h>
-#include <dirent.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <string.h>
 #include "library.h"
 
+typedef struct {
+	int attr;
+	char *startVal;
+	char *endVal;
+	int comparelen;
+	bool exact; //its bitmap index alone gives the matching rows
+	BloomFilters *bloom; //for an equality on whole values, the page filters
+} Predicate;
+
+void split_list(char *list, std::vector<char *> *items);
+void match_rows(Colstore *colstore, RowGroup *group, long groupFirstPage, Predicate *pred, bool allRows,
+	uint64_t rangeFirst, uint64_t rangeLast, std::vector<int> *rows, char *buf);
+
 int main(int argc, char *argv[])
 {	
 
 	if (argc != 7)
 	{
-		fprintf(stderr, "USAGE: select3 <colstore_name> <attribute_id> "
-			"<return_attribute_id> <start> <end> <page_size>\n");
+		fprintf(stderr, "USAGE: select3 <colstore_name> <attribute_id>[,<attribute_id>...] "
+			"<return_attribute_id>[,<return_attribute_id>...] <start>[,<start>...] <end>[,<end>...] "
+			"<page_size>\n");
 		exit(1);
 	}
 
 	//start timer
     clock_t start = clock();
 
-	char *dirName = argv[1];
-	char *cmpFile = argv[2];
-	char *retFile = argv[3];
+	char *storeName = argv[1];
+	char *cmpAttrName = argv[2];
+	char *retAttrName = argv[3];
 	char *startVal = argv[4];
 	char *endVal = argv[5];
 	int pageSize = atoi(argv[6]);
-	std::vector<RecordID> recordIds;
-
-	//assuming: colstore_name is a directory that exists
 
-	DIR *colStore = opendir(argv[1]);
-	if (colStore == NULL)
+	//one predicate per compare attribute, all of which must hold
+	std::vector<char *> cmpNames, startVals, endVals;
+	split_list(cmpAttrName, &cmpNames);
+	split_list(startVal, &startVals);
+	split_list(endVal, &endVals);
+	if (cmpNames.empty() || startVals.size() != cmpNames.size() || endVals.size() != cmpNames.size())
 	{
-		fprintf(stderr, "Could not open directory %s for reading.\n", argv[1]);
+		fprintf(stderr, "Need one <start> and one <end> per compare attribute\n");
 		exit(1);
-
 	}
-
-	//find file for attribute to compare
-	struct dirent *entr = readdir(colStore);
-	int filesFound = 0;
-	while (entr != NULL && filesFound  < 2)
+	std::vector<Predicate> preds(cmpNames.size());
+	bool validAttrs = true;
+	for (int i = 0; i < preds.size(); i++)
 	{
-		if (strncmp(entr->d_name, cmpFile, strlen(cmpFile)) == 0)
-			filesFound++;
-		if (strncmp(entr->d_name, retFile, strlen(retFile)) == 0)
-			filesFound++;
-		entr = readdir(colStore);
+		preds[i].attr = atoi(cmpNames[i]);
+		preds[i].startVal = startVals[i];
+		preds[i].endVal = endVals[i];
+		int comparelen = (strlen(startVals[i]) < ATTRIBUTE_SIZE) ? strlen(startVals[i])  : ATTRIBUTE_SIZE;
+		preds[i].comparelen = (strlen(endVals[i]) < comparelen) ? strlen(endVals[i]) : comparelen;
+		preds[i].exact = false;
+		preds[i].bloom = NULL;
+		validAttrs = validAttrs && preds[i].attr >= 0 && preds[i].attr < ATTR_PER_RECORD;
 	}
-	closedir(colStore);
-
-	if (entr == NULL && filesFound < 2)
+	std::vector<int> retAttrs; //return attributes, printed in this order
+	std::string retList(retAttrName);
+	for (char *name = strtok(&retList[0], ","); name != NULL; name = strtok(NULL, ","))
+	{
+		retAttrs.push_back(atoi(name));
+		if (retAttrs.back() < 0 || retAttrs.back() >= ATTR_PER_RECORD)
+		{
+			retAttrs.clear();
+			break;
+		}
+	}
+	if (!validAttrs || retAttrs.empty())
 	{
-		fprintf(stderr, "Could not find both files for attributes %s and %s\n", cmpFile, retFile);
+		fprintf(stderr, "Could not find columns for attributes %s and %s\n", cmpAttrName, retAttrName);
 		exit(1);
 	}
+	int numRet = retAttrs.size();
 
-	if (chdir(dirName) == -1)
+	FILE *f = fopen(storeName, "rb");
+	if (f == NULL)
 	{
-		fprintf(stderr, "Could not navigate to storage directory: %s", dirName);
+		fprintf(stderr, "Could not open column store %s for reading.\n", storeName);
 		exit(1);
 	}
-
-	Heapfile *compareFile = new Heapfile();
-	FILE *f1 = fopen(cmpFile, "rb");
-	if (f1 == NULL)
+	Colstore colstore;
+	if (!open_colstore(&colstore, pageSize, f))
 	{
-		fprintf(stderr, "Could not open attribute file %s for reading.\n", cmpFile);
 		exit(1);
-
 	}
 
-    fread(compareFile, sizeof(Heapfile), 1, f1);
-    compareFile->file_ptr = f1;
-    compareFile->page_size = pageSize;
-
-	RecordIterator *recIter = new RecordIterator(compareFile);
-	
-	int comparelen = (strlen(startVal) < ATTRIBUTE_SIZE) ? strlen(startVal)  : ATTRIBUTE_SIZE;
-	comparelen = (strlen(endVal) < comparelen) ? strlen(endVal) : comparelen;
+	char *buf = (char *) malloc(column_page_buffer_size(pageSize));
+	EncodedPage page;
+	std::vector<int> rows; //matching rows of the current row group, in order
+	std::vector<char> values; //return values of each matching row
 
-
-	while (recIter->hasNext())
+	//bitmap indexes answer their predicates before any page is read: the
+	//rows of the prefixes in range are OR-ed, then AND-ed across predicates
+	Bitmap candidates;
+	bool useBitmaps = false;
+	for (int i = 0; i < preds.size(); i++)
 	{
-		RecordID curId = *recIter->cur_rid;
-		Record rec = recIter->next();
-		if (rec.size() != 1)
+		FILE *indexFile = fopen(bitmap_index_path(storeName, preds[i].attr).c_str(), "rb");
+		if (indexFile == NULL)
 		{
-			fprintf(stderr, "Error: Record size is %d\n", (int)rec.size());
-			exit(1);
+			continue;
 		}
-
-		if (memcmp(startVal, rec[0], comparelen) <= 0
-			&& memcmp(endVal, rec[0], comparelen) >= 0)
-			recordIds.push_back(curId);
+		BitmapIndex index;
+		if (read_bitmap_index(&index, indexFile))
+		{
+			if (index.attr_id == preds[i].attr && index.num_rows == colstore.num_rows)
+			{
+				Bitmap predRows;
+				preds[i].exact = bitmap_index_range(&index, preds[i].startVal, preds[i].endVal,
+					preds[i].comparelen, &predRows);
+				if (useBitmaps)
+				{
+					bitmap_and(&candidates, &predRows, &candidates);
+				}
+				else
+				{
+					candidates.swap(predRows);
+				}
+				useBitmaps = true;
+			}
+			free_bitmap_index(&index);
+		}
+		fclose(indexFile);
 	}
-
-	Heapfile *resultFile = new Heapfile();
-	FILE *f2 = fopen(retFile, "rb");
-	if (f2 == NULL)
+	std::vector<uint32_t> candidateRows;
+	bitmap_rows(&candidates, &candidateRows);
+
+	//equalities on whole values skip the pages their Bloom filter rules out
+	BloomFilters bloom;
+	bool haveBloom = false;
+	FILE *bloomFile = fopen(bloom_path(storeName).c_str(), "rb");
+	if (bloomFile != NULL)
 	{
-		fprintf(stderr, "Could not open attribute file %s for reading\n", retFile);
-		exit(1);	
-
+		haveBloom = read_bloom_filters(&bloom, bloomFile);
+		fclose(bloomFile);
+	}
+	for (int i = 0; i < preds.size() && haveBloom; i++)
+	{
+		if (preds[i].comparelen == ATTRIBUTE_SIZE && memcmp(preds[i].startVal, preds[i].endVal, ATTRIBUTE_SIZE) == 0)
+		{
+			preds[i].bloom = &bloom;
+		}
 	}
 
-    fread(resultFile, sizeof(retFile), 1, f2);
-    resultFile->file_ptr = f2;
-    resultFile->page_size = pageSize;
-	int maxIter = recordIds.size();
-	int i = 0;
-
-
-	//plan: read in one page at a time, scan through result-set RIDs 
-	//return those that are in this page, delete from vector
-	while (!recordIds.empty() && i < maxIter)
+	//on the sort attribute, the rows of the range are found by binary
+	//search and only the compare pages holding them are read
+	uint64_t rangeFirst = 0;
+	uint64_t rangeLast = colstore.num_rows;
+	for (int i = 0; i < preds.size(); i++)
 	{
-		
-		int pid = recordIds[0].page_id; //arbitrarily pick the first recordId
-		
-		//cout << "PageId is: " << pid << endl;
-		Page *curPage = new Page();
-		read_page(resultFile, pid, curPage);
-
-		if (curPage->data == NULL)
+		uint64_t first, last;
+		if (colstore_sorted_rows(&colstore, preds[i].attr, preds[i].startVal, preds[i].endVal,
+			preds[i].comparelen, &first, &last))
 		{
-			cout << "READ FAIL" << endl;
-			exit(1);
+			rangeFirst = std::max(rangeFirst, first);
+			rangeLast = std::min(rangeLast, last);
 		}
+	}
 
-		//cout << "Page read successfully" << endl;
-		std::vector<RecordID>::iterator it = recordIds.begin();
+	//plan: per row group, evaluate the predicates on the compare chunks,
+	//reading only pages that may hold a candidate row, then read the pages
+	//of the return chunks, stored next to them, that hold a match
+	int nextCandidate = 0;
+	long groupFirstPage = 0; //pages of each column in earlier row groups
+	for (int g = 0; g < colstore.row_groups->size(); g++)
+	{
+		RowGroup *group = &colstore.row_groups->at(g);
+		//every chunk of a row group has the same number of pages
+		groupFirstPage += (g > 0) ? colstore.row_groups->at(g - 1).chunks[0].size() : 0;
+		if (group->first_row >= rangeLast)
+		{
+			break;
+		}
+		if (group->first_row + group->num_rows <= rangeFirst)
+		{
+			continue;
+		}
 
-		//cout << "First RID is " << it->page_id << " ," << it->slot << endl;
+		rows.clear();
+		for (; nextCandidate < candidateRows.size()
+			&& candidateRows[nextCandidate] < group->first_row + group->num_rows; nextCandidate++)
+		{
+			if (candidateRows[nextCandidate] >= rangeFirst && candidateRows[nextCandidate] < rangeLast)
+			{
+				rows.push_back(candidateRows[nextCandidate] - group->first_row);
+			}
+		}
+		bool allRows = !useBitmaps;
+		for (int i = 0; i < preds.size(); i++)
+		{
+			if (!preds[i].exact)
+			{
+				match_rows(&colstore, group, groupFirstPage, &preds[i], allRows, rangeFirst, rangeLast, &rows, buf);
+				allRows = false;
+			}
+		}
 
-		//cout << "RecordList size is " << recordIds.size() << endl;
-		
-		//for (std::vector<RecordID>::iterator it = recordIds.begin(); 
-				//it != recordIds.end(); it++)
-		while (it != recordIds.end())
+		//late materialization: rows are in order, so one pass over each
+		//return chunk reads every page holding a match exactly once
+		values.resize(rows.size() * numRet * ATTRIBUTE_SIZE);
+		for (int a = 0; a < numRet; a++)
 		{
-			if (it->page_id == pid)
+			std::vector<ColumnPageInfo> *retChunk = &group->chunks[retAttrs[a]];
+			int p = -1;
+			int pageStart = 0;
+			int pageEnd = 0;
+			for (int i = 0; i < rows.size(); i++)
 			{
-				//cout << "inside loop now " << endl;
-				Record *curRec = new Record();
-				//cout << "current slot is: " << it->slot << endl;
-				read_fixed_len_page(curPage, it->slot, curRec);
-				
-				if (curRec->size() != 1)
-				{	
-					cout << "Record size is: " << curRec->size() << endl;
-					fprintf(stderr, "Page info is %d, %d\n", curPage->page_size, curPage->slot_size);
-					exit(1);
+				while (rows[i] >= pageEnd)
+				{
+					p++;
+					pageStart = pageEnd;
+					pageEnd += retChunk->at(p).num_values;
+					if (rows[i] < pageEnd && !read_column_page(&colstore, &retChunk->at(p), buf, &page))
+					{
+						cout << "READ FAIL" << endl;
+						exit(1);
+					}
 				}
-				//fixed_len_read(buf, ATTRIBUTE_SIZE, curRec);
-				char temp[6]; 
-				memset(temp, '\0', 6);
-				strncpy(temp, curRec->at(0), 5);
-				fprintf(stdout, "%s \n", temp);
-
-				it = recordIds.erase(it);
-				//cout << "Size of recordIds is : " << recordIds.size() << endl;
+				column_page_value(&page, rows[i] - pageStart, &values[(i * numRet + a) * ATTRIBUTE_SIZE]);
 			}
-			else
-				it++;
 		}
-		i++;
-		delete curPage;
-	}
 
+		for (int i = 0; i < rows.size(); i++)
+		{
+			for (int a = 0; a < numRet; a++)
+			{
+				fprintf(stdout, "%.5s ", &values[(i * numRet + a) * ATTRIBUTE_SIZE]);
+			}
+			fputs("\n", stdout);
+		}
+	}
 
-	if (!recordIds.empty()) //smthg weird happened
+	free(buf);
+	if (haveBloom)
 	{
-		fprintf(stderr, "Error: recordIds not empty at end of loops\n");
-		exit(1);
+		free_bloom_filters(&bloom);
 	}
-
-	fclose(compareFile->file_ptr);
-	fclose(resultFile->file_ptr);
+	close_colstore(&colstore);
 
 	int msecTime = (clock() - start) * 1000 / CLOCKS_PER_SEC;
     fprintf(stdout, "TIME: %d milliseconds\n", msecTime);
@@ -186,3 +253,81 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
+
+/**
+ * Split a comma-separated list in place.
+ */
+void split_list(char *list, std::vector<char *> *items)
+{
+	for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ","))
+	{
+		items->push_back(item);
+	}
+}
+
+/**
+ * Keep the rows of the group that match pred. With allRows, every row
+ * within [rangeFirst, rangeLast) is a candidate; otherwise only pages
+ * holding one of rows are read. Pages whose min and max or Bloom filter
+ * rule out a match are not read either.
+ */
+void match_rows(Colstore *colstore, RowGroup *group, long groupFirstPage, Predicate *pred, bool allRows,
+	uint64_t rangeFirst, uint64_t rangeLast, std::vector<int> *rows, char *buf)
+{
+	std::vector<ColumnPageInfo> *chunk = &group->chunks[pred->attr];
+	int valuesPerPage = colstore->page_size / ATTRIBUTE_SIZE;
+	std::vector<uint64_t> match(slot_bitmap_words(valuesPerPage));
+	std::vector<int> kept;
+	EncodedPage page;
+	int i = 0; //next candidate row
+	int p = (allRows && rangeFirst > group->first_row) ? (rangeFirst - group->first_row) / valuesPerPage : 0;
+	int firstRow = p * valuesPerPage;
+	for (; p < chunk->size(); p++)
+	{
+		int count = chunk->at(p).num_values;
+		if (allRows ? group->first_row + firstRow >= rangeLast : i == rows->size())
+		{
+			break;
+		}
+		bool candidate = allRows || rows->at(i) < firstRow + count;
+		if (candidate && pred->bloom != NULL)
+		{
+			candidate = bloom_may_contain(pred->bloom, pred->attr, groupFirstPage + p, pred->startVal);
+		}
+		if (candidate && column_page_may_match(&chunk->at(p), pred->startVal, pred->endVal, pred->comparelen))
+		{
+			if (!read_column_page(colstore, &chunk->at(p), buf, &page))
+			{
+				exit(1);
+			}
+			//the predicate is evaluated on the encoded page
+			column_page_match(&page, pred->startVal, pred->endVal, pred->comparelen, &match[0]);
+			if (allRows)
+			{
+				for (int w = 0; w < slot_bitmap_words(count); w++)
+				{
+					uint64_t bits = match[w];
+					while (bits != 0)
+					{
+						kept.push_back(firstRow + w * 64 + __builtin_ctzll(bits));
+						bits &= bits - 1;
+					}
+				}
+			}
+			for (; !allRows && i < rows->size() && rows->at(i) < firstRow + count; i++)
+			{
+				int slot = rows->at(i) - firstRow;
+				if ((match[slot / 64] >> (slot % 64)) & 1)
+				{
+					kept.push_back(rows->at(i));
+				}
+			}
+		}
+		while (!allRows && i < rows->size() && rows->at(i) < firstRow + count)
+		{
+			i++;
+		}
+		firstRow += count;
+	}
+	rows->swap(kept);
+}
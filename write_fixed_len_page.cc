@@ -39,14 +39,9 @@ int main(int argc, char *argv[])
 		init_fixed_len_page(page, pageSize, SLOT_SIZE);
 		numRecords += read_csv2page(&csvfile, page);
 
-		char *slot_info = (char *) malloc(fixed_len_page_capacity(page) * sizeof(char));
-		write_bytes(page->slot_info, slot_info);
-
-		//cout << "Byte array is: " << slot_info << endl;
-
 		//write page to file
 		fwrite(page, sizeof(Page), 1, pageFile);
-		fwrite(slot_info, fixed_len_page_capacity(page), 1, pageFile);
+		fwrite(page->slot_bitmap, slot_bitmap_size(page), 1, pageFile);
 		fwrite(page->data, page->page_size, 1, pageFile);
 
 		char buf[page->page_size + 1];